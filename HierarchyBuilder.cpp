@@ -5,7 +5,29 @@
 #include <assert.h>
 #include <string>
 #include <unordered_map>
+#include <list>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
 #include <vector>
+#include <utility>
+#if HIERARCHY_BUILDER_STATS
+#include <chrono>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef _MSC_VER
 #pragma warning(disable:4100)
@@ -13,772 +35,4632 @@
 
 #define LOG_CHAIN 0	// True to debug how the hierarchy chain is being built
 
+// Statements which only gather build statistics
+#if HIERARCHY_BUILDER_STATS
+#define HB_STAT(x) x
+#else
+#define HB_STAT(x)
+#endif
+
 namespace HIERARCHY_BUILDER
 {
 
-class RigidBodyRef
-{
-public:
-	std::string	mName;
-	bool		mUsed{ false };	//whether not this rigid body is part of an hierarchy
-};
+typedef std::vector< const char * > StringVector;
+typedef std::vector< uint32_t > IndexVector;
+typedef std::vector< uint8_t > ByteVector;
 
-typedef std::vector< RigidBodyRef > RigidBodyRefVector;
-typedef std::vector< std::string > StringVector;
+#define INVALID_INDEX 0xFFFFFFFF
 
-class JointRef
+template< typename T > size_t vectorBytes(const std::vector< T > &v)
 {
-public:
-	bool		mUsed{ false };	// whether or not this joint has been added to an hierarchy yet or not
-	std::string	mName;
-	std::string	mBody0;
-	std::string mBody1;
-};
+	return v.capacity() * sizeof(T);
+}
 
-typedef std::vector< JointRef > JointRefVector;
+#if HIERARCHY_BUILDER_STATS
+// Measures the wall time of consecutive phases
+class Timer
+{
+public:
+	Timer(void) : mStart(std::chrono::steady_clock::now())
+	{
+	}
 
-class Link;
+	// Returns the milliseconds since construction or the previous call, and restarts
+	double lap(void)
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		double ret = std::chrono::duration< double, std::milli >(now - mStart).count();
+		mStart = now;
+		return ret;
+	}
 
-typedef std::vector< Link *> LinkVector;
+private:
+	std::chrono::steady_clock::time_point	mStart;
+};
+#endif
 
-class Link : public HierarchyLink
+// Incremental 128 bit hash of the inputs, as two differently seeded 64 bit lanes which are each mixed
+// and finalized on their own.  This identifies inputs for the result cache; it is not cryptographic.
+class InputHash
 {
 public:
-	Link(void)
+	void addValue(uint64_t v)
 	{
+		mLow = rotate(mLow ^ (v * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+		mHigh = rotate(mHigh ^ (v * 0x9e3779b97f4a7c15ULL), 33) * 0xc2b2ae3d27d4eb4fULL + mLow;
 	}
-	virtual ~Link(void)
+
+	void addBytes(const char *data, size_t len)
 	{
-		for (auto &i : mChildren)
+		addValue(len);
+		while (len >= 8)
 		{
-			delete i;
+			uint64_t v;
+			memcpy(&v, data, 8);
+			addValue(v);
+			data += 8;
+			len -= 8;
+		}
+		if (len)
+		{
+			uint64_t v = 0;
+			memcpy(&v, data, len);
+			addValue(v);
 		}
 	}
 
-	enum LinkOrder
+	HierarchyKey getKey(void) const
 	{
-		LO_NOT_LINKED,
-		LO_BODY0,
-		LO_BODY1
-	};
+		HierarchyKey ret;
+		ret.mLow = finalize(mLow + mHigh);
+		ret.mHigh = finalize(mHigh ^ mLow);
+		return ret;
+	}
+
+private:
+	static uint64_t rotate(uint64_t v, uint32_t bits)
+	{
+		return (v << bits) | (v >> (64 - bits));
+	}
+
+	static uint64_t finalize(uint64_t v)
+	{
+		v ^= v >> 33;
+		v *= 0xff51afd7ed558ccdULL;
+		v ^= v >> 33;
+		v *= 0xc4ceb9fe1a85ec53ULL;
+		v ^= v >> 33;
+		return v;
+	}
 
-	LinkOrder isLinked(const JointRef &jref) const
+	uint64_t	mLow{ 0x243f6a8885a308d3ULL };
+	uint64_t	mHigh{ 0x13198a2e03707344ULL };
+};
+
+// Operations recorded in the input hash
+enum InputOperation
+{
+	INPUT_RIGID_BODY = 1,
+	INPUT_UNNAMED_RIGID_BODY,
+	INPUT_JOINT,
+	INPUT_UNNAMED_JOINT,
+	INPUT_REMOVE_JOINT,
+	INPUT_REMOVE_RIGID_BODY,
+	INPUT_BUILD_OPTIONS		// Only mixed into the key of a cached result
+};
+
+// Stores copies of names back to back in large blocks, so each name costs only its characters.
+// Pointers into the pool stay valid until clear().
+class StringPool
+{
+public:
+	~StringPool(void)
 	{
-		LinkOrder lo = LO_NOT_LINKED;
+		clear();
+	}
 
-		if (mRigidBody == jref.mBody0)
+	const char *store(const char *str, size_t len)
+	{
+		if (mBlocks.empty() || mUsed + len + 1 > mBlockSize)
 		{
-			lo = LO_BODY0;
+			mBlockSize = len + 1 > size_t(POOL_BLOCK_SIZE) ? len + 1 : size_t(POOL_BLOCK_SIZE);
+			mBlocks.push_back(new char[mBlockSize]);
+			mReserved += mBlockSize;
+			mUsed = 0;
 		}
-		else if (mRigidBody == jref.mBody1)
+		char *ret = mBlocks.back() + mUsed;
+		memcpy(ret, str, len);
+		ret[len] = 0;
+		mUsed += len + 1;
+		return ret;
+	}
+
+	void clear(void)
+	{
+		for (auto &i : mBlocks)
 		{
-			lo = LO_BODY1;
+			delete []i;
 		}
+		mBlocks.clear();
+		mBlockSize = 0;
+		mUsed = 0;
+		mReserved = 0;
+	}
+
+	size_t getReservedBytes(void) const
+	{
+		return mReserved;
+	}
+
+private:
+	enum
+	{
+		POOL_BLOCK_SIZE = 64 * 1024
+	};
+
+	std::vector< char * >	mBlocks;
+	size_t					mBlockSize{ 0 };	// Size of the last block
+	size_t					mUsed{ 0 };			// Bytes used in the last block
+	size_t					mReserved{ 0 };
+};
+
+// Interns names into dense ids (0..n-1, in insertion order) using an open addressing hash table
+// with linear probing.  The hash of each name is computed once and kept alongside it, so lookups
+// only compare strings whose hashes match and growing the table never rehashes a string.
+// Each name is kept as a pointer and length.  Names are copied into a pool unless they are borrowed,
+// in which case the caller's own pointers are kept and handed back by getName().
+//
+// Copied names may instead be front coded.  Each name is then a record in mCodes holding the distance back
+// to the record of the name added before it, how many leading characters it shares with that name, and the
+// characters which follow them.  Every MAX_CHAIN names, or whenever too little is shared, a record holds the
+// whole name instead, so decoding a name never walks back more than MAX_CHAIN records.
+class NameTable
+{
+public:
+	// When set, every name inserted must outlive the table
+	void setBorrowNames(bool borrowNames)
+	{
+		mBorrowNames = borrowNames;
+	}
 
-		return lo;
+	// When set, and names are not borrowed, names are front coded and getName() decodes them
+	void setCompressNames(bool compressNames)
+	{
+		mCompressNames = compressNames;
 	}
 
+	// FNV-1a
+	static uint32_t hashName(const char *name, size_t &len)
+	{
+		uint32_t hash = 2166136261u;
+		const char *scan = name;
+		while (*scan)
+		{
+			hash ^= uint8_t(*scan++);
+			hash *= 16777619u;
+		}
+		len = size_t(scan - name);
+		return hash;
+	}
 
-	Link * add(const JointRef &jref)
+	// Returns the id of this name or INVALID_INDEX if it has not been added
+	uint32_t find(const char *name) const
 	{
-		Link *ret = nullptr;
+		size_t len;
+		uint32_t hash = hashName(name, len);
+		return mSlots.empty() ? INVALID_INDEX : mSlots[findSlot(name, len, hash)];
+	}
 
-		LinkOrder lo = isLinked(jref);
+	// Adds this name and returns its new id; returns INVALID_INDEX if the name already exists
+	uint32_t insert(const char *name)
+	{
+		uint32_t ret = INVALID_INDEX;
 
-		if (lo != LO_NOT_LINKED)
+		if ((mNamedCount + 1) * 2 > mSlots.size())
+		{
+			rehash(mSlots.empty() ? size_t(MIN_SLOTS) : mSlots.size() * 2);
+		}
+		size_t len;
+		uint32_t hash = hashName(name, len);
+		uint32_t slot = findSlot(name, len, hash);
+		if (mSlots[slot] == INVALID_INDEX)
 		{
-			if (lo == LO_BODY0)
+			ret = uint32_t(mLengths.size());
+			mSlots[slot] = ret;
+			if (isCompressed())
 			{
-				ret = new Link;
-				ret->mJointName = jref.mName;
-				ret->mRigidBody = jref.mBody1;
-				mChildren.push_back(ret);
+				mOffsets.push_back(encodeName(name, len));
 			}
 			else
 			{
-				ret = new Link;	
-				ret->mJointName = jref.mName;
-				ret->mRigidBody = jref.mBody1;
-				ret->mChildren = mChildren;	// New link inherits his children
-				mChildren.clear();
-				mRigidBody = jref.mBody0; // 
-				mChildren.push_back(ret); // new head of linked list...
+				mNames.push_back(mBorrowNames ? name : mPool.store(name, len));
 			}
+			mLengths.push_back(uint32_t(len));
+			mHashes.push_back(hash);
+			mNamedCount++;
+		}
+
+		return ret;
+	}
+
+	// Adds an entry with no name; it is never found by name and its name is an empty string
+	uint32_t insertUnnamed(void)
+	{
+		uint32_t ret = uint32_t(mLengths.size());
+		if (isCompressed())
+		{
+			mOffsets.push_back(INVALID_INDEX);
 		}
 		else
 		{
-			// Recursively descend the tree to see if this joint attaches to anywhere in the existing
-			// hierarchy
-			for (auto &i : mChildren)
+			mNames.push_back("");
+		}
+		mLengths.push_back(0);
+		mHashes.push_back(0);
+		return ret;
+	}
+
+	// Removes a name so that it can no longer be found and may be added again under a new id.
+	// The id itself is not reused; its name becomes an empty string.
+	void erase(uint32_t id)
+	{
+		if (!isUnnamed(id))
+		{
+			uint32_t mask = uint32_t(mSlots.size()) - 1;
+			uint32_t slot = mHashes[id] & mask;
+			while (mSlots[slot] != id)
+			{
+				slot = (slot + 1) & mask;
+			}
+			// Backward shift deletion; move up any following entries which can no longer be
+			// reached once this slot is empty
+			uint32_t next = (slot + 1) & mask;
+			while (mSlots[next] != INVALID_INDEX)
 			{
-				ret = i->add(jref);
-				if (ret)
+				uint32_t home = mHashes[mSlots[next]] & mask;
+				if (((next - home) & mask) >= ((next - slot) & mask))
 				{
-					break;
+					mSlots[slot] = mSlots[next];
+					slot = next;
 				}
+				next = (next + 1) & mask;
 			}
+			mSlots[slot] = INVALID_INDEX;
+			mNamedCount--;
 		}
-
-		return ret;
+		// The characters of a pooled name are only reclaimed by clear().  A front coded record stays as it
+		// is, since the names added after it may be coded against it.
+		if (!isCompressed())
+		{
+			mNames[id] = "";
+		}
+		mLengths[id] = 0;
+		mHashes[id] = 0;
 	}
 
-	void indent(uint32_t depth) const
+	// Make room for this many entries in total without growing
+	void reserve(uint32_t count)
 	{
-		for (uint32_t i = 0; i < depth; i++)
+		if (isCompressed())
+		{
+			mOffsets.reserve(count);
+		}
+		else
+		{
+			mNames.reserve(count);
+		}
+		mLengths.reserve(count);
+		mHashes.reserve(count);
+		size_t capacity = mSlots.empty() ? size_t(MIN_SLOTS) : mSlots.size();
+		while (capacity < size_t(count) * 2)
+		{
+			capacity *= 2;
+		}
+		if (capacity > mSlots.size())
 		{
-			printf("    ");
+			rehash(capacity);
 		}
 	}
 
-	virtual void printChain(uint32_t depth) const override final
+	// A front coded name is decoded into one of DECODED_NAME_COUNT buffers owned by the calling thread,
+	// which is reused once that many more names have been returned on the thread
+	const char *getName(uint32_t id) const
+	{
+		static thread_local DecodedNames decoded;
+		return isCompressed() ? decodeName(id, decoded) : mNames[id];
+	}
+
+	// The same for names the builder only uses itself, while looking up, hashing, saving or printing names.
+	// These are decoded into buffers of their own, so they never reuse a buffer holding a name which was
+	// returned by getName.
+	const char *getScratchName(uint32_t id) const
+	{
+		static thread_local DecodedNames decoded;
+		return isCompressed() ? decodeName(id, decoded) : mNames[id];
+	}
+
+	size_t getNameLength(uint32_t id) const
+	{
+		return mLengths[id];
+	}
+
+	uint32_t size(void) const
+	{
+		return uint32_t(mLengths.size());
+	}
+
+	void clear(void)
+	{
+		mNames.clear();
+		mOffsets.clear();
+		mCodes.clear();
+		mLastName.clear();
+		mLastOffset = INVALID_INDEX;
+		mLastDepth = 0;
+		mLengths.clear();
+		mHashes.clear();
+		mSlots.clear();
+		mNamedCount = 0;
+		mPool.clear();
+	}
+
+#if HIERARCHY_BUILDER_STATS
+	// Bytes held, including the pooled characters but not borrowed names
+	size_t getMemoryUsage(void) const
+	{
+		size_t ret = vectorBytes(mNames) + vectorBytes(mLengths) + vectorBytes(mHashes) + vectorBytes(mSlots) + mPool.getReservedBytes();
+		ret += vectorBytes(mOffsets) + vectorBytes(mCodes) + mLastName.capacity();
+		return ret;
+	}
+#endif
+
+	bool isUnnamed(uint32_t id) const
+	{
+		return mHashes[id] == 0 && mLengths[id] == 0;
+	}
+
+private:
+	enum
+	{
+		MIN_SLOTS = 64,
+		MAX_CHAIN = 8,				// Most records between a name and the whole name it is decoded from
+		MIN_SHARED_PREFIX = 3,		// Fewer shared characters than this are not worth a reference
+		DECODED_NAME_COUNT = 8		// Decoded names each thread can hold at once
+	};
+
+	class DecodedNames
 	{
-		for (auto &i : mChildren)
+	public:
+		std::string	mNames[DECODED_NAME_COUNT];
+		uint32_t	mNext{ 0 };
+	};
+
+	// Returns the slot holding this name, or the empty slot where it would be inserted
+	uint32_t findSlot(const char *name, size_t len, uint32_t hash) const
+	{
+		uint32_t mask = uint32_t(mSlots.size()) - 1;
+		uint32_t slot = hash & mask;
+		for (;;)
 		{
-			indent(depth);
-			printf("%s->%s  : JointName: %s : IsLoopJoint(%s)\r\n", 
-				mRigidBody.c_str(), 
-				i->mRigidBody.c_str(), 
-				i->mJointName.c_str(), 
-				i->mIsLoopJoint ? "true" : "false");
+			uint32_t id = mSlots[slot];
+			if (id == INVALID_INDEX)
+			{
+				break;
+			}
+			if (mHashes[id] == hash && mLengths[id] == len && memcmp(getScratchName(id), name, len) == 0)
+			{
+				break;
+			}
+			slot = (slot + 1) & mask;
 		}
-		for (auto &i : mChildren)
+		return slot;
+	}
+
+	void rehash(size_t capacity)
+	{
+		mSlots.assign(capacity, INVALID_INDEX);
+		uint32_t mask = uint32_t(capacity) - 1;
+		for (uint32_t i = 0; i < uint32_t(mLengths.size()); i++)
 		{
-			i->printChain(depth + 1);
+			if (isUnnamed(i))
+			{
+				continue;
+			}
+			uint32_t slot = mHashes[i] & mask;
+			while (mSlots[slot] != INVALID_INDEX)
+			{
+				slot = (slot + 1) & mask;
+			}
+			mSlots[slot] = i;
 		}
 	}
 
-	bool isDuplicate(const JointRef &ref)
+	bool isCompressed(void) const
 	{
-		bool ret = false;
+		return mCompressNames && !mBorrowNames;
+	}
+
+	// Appends the record of a new name to mCodes and returns its offset
+	uint32_t encodeName(const char *name, size_t len)
+	{
+		uint32_t ret = uint32_t(mCodes.size());
 
-		for (auto &i : mChildren)
+		size_t shared = 0;
+		if (mLastOffset != INVALID_INDEX && mLastDepth < MAX_CHAIN)
 		{
-			// If this joint is already represented in this hierarchy, then return true.
-			// Same parent, same child, and same joint name
-			if (ref.mBody0 == mRigidBody && ref.mBody1 == i->mRigidBody && ref.mName == i->mJointName )
+			size_t limit = std::min(len, mLastName.size());
+			while (shared < limit && name[shared] == mLastName[shared])
 			{
-				ret = true;
-				break;
+				shared++;
 			}
 		}
-		if (!ret)
+		if (shared < MIN_SHARED_PREFIX)
+		{
+			writeVarint(0);
+			shared = 0;
+			mLastDepth = 0;
+		}
+		else
+		{
+			writeVarint(ret - mLastOffset);
+			writeVarint(uint32_t(shared));
+			mLastDepth++;
+		}
+		writeVarint(uint32_t(len - shared));
+		mCodes.insert(mCodes.end(), name + shared, name + len);
+		mLastName.assign(name, len);
+		mLastOffset = ret;
+
+		return ret;
+	}
+
+	const char *decodeName(uint32_t id, DecodedNames &decoded) const
+	{
+		std::string &ret = decoded.mNames[decoded.mNext++ % DECODED_NAME_COUNT];
+		ret.clear();
+		if (mLengths[id])
 		{
-			for (auto &i : mChildren)
+			// Walk back to the record holding a whole name, then apply the records forwards from there
+			uint32_t chain[MAX_CHAIN + 1];
+			uint32_t count = 0;
+			uint32_t offset = mOffsets[id];
+			for (;;)
 			{
-				if (i->isDuplicate(ref))
+				chain[count++] = offset;
+				const uint8_t *scan = &mCodes[offset];
+				uint32_t back = readVarint(scan);
+				if (back == 0)
 				{
-					ret = true;
 					break;
 				}
+				offset -= back;
+			}
+			while (count)
+			{
+				const uint8_t *scan = &mCodes[chain[--count]];
+				uint32_t shared = readVarint(scan) ? readVarint(scan) : 0;
+				uint32_t length = readVarint(scan);
+				ret.resize(shared);
+				ret.append(reinterpret_cast<const char *>(scan), length);
 			}
 		}
+		return ret.c_str();
+	}
 
+	void writeVarint(uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			mCodes.push_back(uint8_t(value | 0x80));
+			value >>= 7;
+		}
+		mCodes.push_back(uint8_t(value));
+	}
 
+	static uint32_t readVarint(const uint8_t *&scan)
+	{
+		uint32_t ret = 0;
+		uint32_t shift = 0;
+		while (*scan & 0x80)
+		{
+			ret |= uint32_t(*scan++ & 0x7F) << shift;
+			shift += 7;
+		}
+		ret |= uint32_t(*scan++) << shift;
 		return ret;
 	}
 
-	void getJointRef(JointRefVector &joints)
+	StringVector	mNames;		// Indexed by id, unless the names are front coded
+	IndexVector		mLengths;	// Length of each name, indexed by id
+	IndexVector		mHashes;	// Precomputed hash of each name, indexed by id
+	IndexVector		mSlots;		// Power of two sized table of ids; INVALID_INDEX if empty
+	size_t			mNamedCount{ 0 };	// Number of ids held in mSlots
+	StringPool		mPool;		// Copies of the names, unless they are borrowed or front coded
+	bool			mBorrowNames{ false };
+	bool			mCompressNames{ false };
+	// Front coded names
+	IndexVector		mOffsets;	// Offset of the record of each name in mCodes, indexed by id; INVALID_INDEX if unnamed
+	ByteVector		mCodes;		// The records, in the order the names were added
+	std::string		mLastName;	// The name added most recently, which the next one is coded against
+	uint32_t		mLastOffset{ INVALID_INDEX };
+	uint32_t		mLastDepth{ 0 };	// Records between the most recent name and the whole name it decodes from
+};
+
+// Used when no allocator is passed to HierarchyBuilder::create
+class DefaultAllocator : public HierarchyAllocator
+{
+public:
+	virtual void *allocate(size_t size) override final
+	{
+		return malloc(size);
+	}
+
+	virtual void deallocate(void *mem) override final
+	{
+		free(mem);
+	}
+};
+
+static DefaultAllocator gDefaultAllocator;
+
+// Bump allocator for the storage of built hierarchies.  Memory is obtained from the
+// HierarchyAllocator in large blocks; rewind() makes every block available again in one step
+// without running any destructors, so everything placed in the arena must be trivially destructible.
+class Arena
+{
+public:
+	Arena(HierarchyAllocator *allocator) : mAllocator(allocator)
+	{
+	}
+
+	~Arena(void)
+	{
+		release();
+	}
+
+	void *alloc(size_t size)
 	{
-		for (auto &i : mChildren)
+		size = (size + (ARENA_ALIGNMENT - 1)) & ~size_t(ARENA_ALIGNMENT - 1);
+		// Find the next block with enough room, keeping blocks retained by a previous rewind
+		while (mCurrent < mBlocks.size() && mUsed + size > mBlocks[mCurrent].mSize)
 		{
-			JointRef j;
-			j.mBody0 = mRigidBody;
-			j.mBody1 = i->mRigidBody;
-			j.mName = i->mJointName;
-			j.mUsed = false; // not used yet..
-			joints.push_back(j);
+			mCurrent++;
+			mUsed = 0;
 		}
-		for (auto &i : mChildren)
+		if (mCurrent == mBlocks.size())
 		{
-			i->getJointRef(joints);
+			size_t blockSize = mBlocks.empty() ? size_t(ARENA_BLOCK_SIZE) : mBlocks.back().mSize * 2;
+			if (blockSize < size)
+			{
+				blockSize = size;
+			}
+			Block b;
+			b.mMemory = static_cast<uint8_t *>(mAllocator->allocate(blockSize));
+			b.mSize = blockSize;
+			mBlocks.push_back(b);
+			mUsed = 0;
 		}
+		void *ret = mBlocks[mCurrent].mMemory + mUsed;
+		mUsed += size;
+		return ret;
 	}
 
-	// Return the number of children links
-	virtual uint32_t getChildCount(void) const override final
+	template< typename T > T *allocArray(size_t count)
 	{
-		return uint32_t(mChildren.size());
+		return static_cast<T *>(alloc(sizeof(T) * count));
 	}
 
-	// Returns the name of the joint and bodies for this child
-	virtual const char *getJoint(uint32_t index, const char *&body0, const char *&body1, bool &isLoopJoint) const override final
+	// Free everything allocated from the arena at once; the blocks are kept for reuse
+	void rewind(void)
 	{
-		const char *ret = nullptr;
+		mCurrent = 0;
+		mUsed = 0;
+	}
+
+	HierarchyAllocator *getAllocator(void) const
+	{
+		return mAllocator;
+	}
 
-		if (index < mChildren.size() )
+#if HIERARCHY_BUILDER_STATS
+	uint32_t getBlockCount(void) const
+	{
+		return uint32_t(mBlocks.size());
+	}
+
+	size_t getReservedBytes(void) const
+	{
+		size_t ret = 0;
+		for (auto &i : mBlocks)
 		{
-			const Link *l = mChildren[index];	// Get this child
-			ret = l->mJointName.c_str();		// Get the name of this joint
-			body0 = mRigidBody.c_str();			// Get parent rigid body name
-			body1 = l->mRigidBody.c_str();		// get child rigid body name
-			isLoopJoint = l->mIsLoopJoint;		// Set flag to indicate if this is a loop joint
+			ret += i.mSize;
 		}
+		return ret;
+	}
 
+	size_t getUsedBytes(void) const
+	{
+		size_t ret = mUsed;
+		for (size_t i = 0; i < mCurrent && i < mBlocks.size(); i++)
+		{
+			ret += mBlocks[i].mSize;
+		}
 		return ret;
 	}
+#endif
 
-	// Returns this child hierarchy link
-	virtual const HierarchyLink *getChild(uint32_t index) const override final
+	// Return all blocks to the allocator
+	void release(void)
 	{
-		const HierarchyLink *ret = nullptr;
+		for (auto &i : mBlocks)
+		{
+			mAllocator->deallocate(i.mMemory);
+		}
+		mBlocks.clear();
+		rewind();
+	}
 
-		if (index < mChildren.size())
+private:
+	enum
+	{
+		ARENA_ALIGNMENT = 16,
+		ARENA_BLOCK_SIZE = 64 * 1024
+	};
+
+	class Block
+	{
+	public:
+		uint8_t	*mMemory;
+		size_t	mSize;
+	};
+
+	HierarchyAllocator		*mAllocator;
+	std::vector< Block >	mBlocks;
+	size_t					mCurrent{ 0 };	// Block currently being allocated from
+	size_t					mUsed{ 0 };		// Bytes used in the current block
+};
+
+class Hierarchy;
+class Link;
+
+// One pending node of the explicit stack used to print a hierarchy
+class PrintFrame
+{
+public:
+	uint32_t	mNode;
+	uint32_t	mDepth;
+};
+
+typedef std::vector< PrintFrame > PrintFrameVector;
+
+// Prints the joints to the children of 'node' and then, in order, the subtree of each child.  An explicit
+// stack is used so that arbitrarily deep chains can be printed.  'names' supplies getBodyName(body) and
+// getJointName(joint) for the handles in the view.
+template< typename Names > void printChain(const HierarchyView &view, const Names &names, uint32_t node, uint32_t depth)
+{
+	PrintFrameVector stack;
+	stack.push_back(PrintFrame{ node, depth });
+	while (!stack.empty())
+	{
+		PrintFrame f = stack.back();
+		stack.pop_back();
+		uint32_t first = view.mChildOffsets[f.mNode];
+		uint32_t last = view.mChildOffsets[f.mNode + 1];
+		for (uint32_t i = first; i < last; i++)
+		{
+			for (uint32_t k = 0; k < f.mDepth; k++)
+			{
+				printf("    ");
+			}
+			printf("%s->%s  : JointName: %s : IsLoopJoint(%s)\r\n",
+				names.getBodyName(view.mRigidBodies[f.mNode]),
+				names.getBodyName(view.mRigidBodies[i]),
+				names.getJointName(view.mJoints[i]),
+				view.mLoopJoints[i] ? "true" : "false");
+		}
+		// Pushed in reverse so the first child is printed first
+		for (uint32_t i = last; i > first; i--)
 		{
-			ret = static_cast<const HierarchyLink *>(mChildren[index]);
+			stack.push_back(PrintFrame{ i - 1, f.mDepth + 1 });
 		}
+	}
+}
+
+// A joint refers to its name by id in the joint name table and to its bodies by rigid body index.
+// Each joint is also a member of two doubly linked lists: the outgoing joints of body0 and the
+// incoming joints of body1.
+class JointRef
+{
+public:
+	uint32_t	mBody0;
+	uint32_t	mBody1;
+	uint32_t	mNextOut{ INVALID_INDEX };
+	uint32_t	mPrevOut{ INVALID_INDEX };
+	uint32_t	mNextIn{ INVALID_INDEX };
+	uint32_t	mPrevIn{ INVALID_INDEX };
+	bool		mRemoved{ false };
+};
+
+typedef std::vector< JointRef > JointRefVector;
+
+// Per rigid body state, indexed by rigid body index.  The lists of outgoing (this body is body0)
+// and incoming (this body is body1) joints are kept in definition order, since new joints always
+// have the highest index and are appended at the tail.
+class RigidBodyRef
+{
+public:
+	uint32_t	mFirstOut{ INVALID_INDEX };
+	uint32_t	mLastOut{ INVALID_INDEX };
+	uint32_t	mFirstIn{ INVALID_INDEX };
+	uint32_t	mLastIn{ INVALID_INDEX };
+	uint32_t	mDisconnectedSlot{ INVALID_INDEX };	// Position in the disconnected rigid body list
+	uint32_t	mDegree{ 0 };						// Joint ends at this body, on either list
+	Hierarchy	*mHierarchy{ nullptr };				// Hierarchy holding this body after a build
+	bool		mRemoved{ false };
+};
+
+typedef std::vector< RigidBodyRef > RigidBodyRefVector;
+
+// A hierarchy refers to its slice of the flat node arrays owned by the builder.  After a full build
+// both live in the builder's arena and are never destroyed individually; a hierarchy rebuilt by
+// an incremental update owns a single allocation instead.  Nodes are laid out
+// breadth first with node 0 as the root, so the children of node 'n' are the contiguous nodes
+// mChildOffsets[n] up to (but not including) mChildOffsets[n+1].
+class Hierarchy
+{
+public:
+	Hierarchy(size_t index) : mIndex(index)
+	{
+	}
+
+	// Only used to print the hierarchy
+	const char *getBodyName(uint32_t body) const
+	{
+		return mBodyNames->getScratchName(body);
+	}
+
+	const char *getJointName(uint32_t joint) const
+	{
+		return mJointNames->getScratchName(joint);
+	}
+
+	void printChain(uint32_t node,uint32_t depth) const
+	{
+		HierarchyView view;
+		getView(view);
+		HIERARCHY_BUILDER::printChain(view, *this, node, depth);
+	}
+
+	void debugPrint(void)
+	{
+		printf("==========================================================\r\n");
+		printf("Hierarchy[%d] with root node of: %s\r\n", 
+			uint32_t(mIndex),
+			mBodyNames->getScratchName(mRigidBodies[0]));
+		printf("==========================================================\r\n");
+		printChain(0, 0);
+		printf("==========================================================\r\n");
+		printf("\r\n");
+	}
+
+	void getView(HierarchyView &view) const
+	{
+		view.mNodeCount		= mNodeCount;
+		view.mRigidBodies	= mRigidBodies;
+		view.mJoints		= mJoints;
+		view.mLoopJoints	= mLoopJoints;
+		view.mChildOffsets	= mChildOffsets;
+	}
+
+	// The loop joints are stored after the bodies in the depth first arrays, so every array has mNodeCount entries
+	void getDepthFirstView(DepthFirstView &view) const
+	{
+		view.mBodyCount			= mBodyCount;
+		view.mRigidBodies		= mDepthFirstBodies;
+		view.mParents			= mDepthFirstParents;
+		view.mJoints			= mDepthFirstJoints;
+		view.mSubtreeEnds		= mSubtreeEnds;
+		view.mLoopJointCount	= mNodeCount - mBodyCount;
+		view.mLoopJoints		= mDepthFirstJoints + mBodyCount;
+		view.mLoopBodies0		= mDepthFirstParents + mBodyCount;
+		view.mLoopBodies1		= mSubtreeEnds + mBodyCount;
+	}
+
+	// Floor of the base 2 logarithm of a non-zero value
+	static uint32_t floorLog2(uint32_t v)
+	{
+		uint32_t ret = 0;
+		for (uint32_t shift = 16; shift; shift >>= 1)
+		{
+			if (v >> shift)
+			{
+				v >>= shift;
+				ret += shift;
+			}
+		}
+		return ret;
+	}
+
+	// Entries of the ancestor table of a hierarchy with this many nodes, which bounds its body count
+	static size_t getAncestorTableSize(uint32_t nodeCount)
+	{
+		return size_t(floorLog2(nodeCount)) * nodeCount;
+	}
+
+	// Level k of the ancestor table holds, for each depth first index i, the smallest parent index of the
+	// 2^k bodies from i.  Level 0 is mDepthFirstParents itself, so the table starts at level 1.
+	void buildAncestorTable(void)
+	{
+		const uint32_t *prev = mDepthFirstParents;
+		uint32_t *level = mAncestorTable;
+		uint32_t levelCount = floorLog2(mBodyCount);
+		for (uint32_t k = 1; k <= levelCount; k++)
+		{
+			uint32_t half = 1u << (k - 1);
+			uint32_t count = mBodyCount - (half << 1) + 1;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				level[i] = std::min(prev[i], prev[i + half]);
+			}
+			prev = level;
+			level += mNodeCount;
+		}
+	}
+
+	// Depth first index of the lowest common ancestor of two depth first indices.  Every body after the
+	// first up to and including the second lies below their common ancestor, and the child of the ancestor
+	// towards the second is among them, so the ancestor is the smallest parent index in that range.  Two
+	// overlapping power of two ranges of the ancestor table cover it.
+	uint32_t findCommonAncestor(uint32_t index0, uint32_t index1) const
+	{
+		uint32_t ret = index0;
+		if (index0 != index1)
+		{
+			if (index0 > index1)
+			{
+				std::swap(index0, index1);
+			}
+			uint32_t k = floorLog2(index1 - index0);
+			const uint32_t *level = k ? mAncestorTable + size_t(k - 1) * mNodeCount : mDepthFirstParents;
+			ret = std::min(level[index0 + 1], level[index1 + 1 - (1u << k)]);
+		}
+		return ret;
+	}
+
+	size_t				mIndex{ 0 };				// Position in the builder's list of hierarchies
+	bool				mOwned{ false };			// True if allocated on its own rather than from the arena
+	bool				mReplaced{ false };			// Used while an incremental update is being applied
+	std::atomic< bool >	mMaterialized{ true };		// False until a hierarchy of a lazy build is first looked at
+	const uint32_t		*mLazyJoints{ nullptr };	// Joints of the component of a lazy build, in definition order
+	uint32_t			mLazyJointCount{ 0 };
+#if HIERARCHY_BUILDER_STATS
+	size_t				mAllocationSize{ 0 };		// Size of the allocation of an owned hierarchy
+#endif
+	uint32_t			mNodeCount{ 0 };
+	uint32_t			*mRigidBodies{ nullptr };	// Rigid body index of each node
+	uint32_t			*mJoints{ nullptr };		// Index of the joint from the parent to each node; INVALID_INDEX for the root
+	uint8_t				*mLoopJoints{ nullptr };	// Non-zero if the joint from the parent to this node is a loop joint
+	uint32_t			*mChildOffsets{ nullptr };	// mNodeCount+1 entries
+	Link				*mLinks{ nullptr };			// HierarchyLink adapter for each node
+	// Depth first layout, only present if requested by the build options.  The first mBodyCount entries
+	// describe the bodies; the entries after them hold the loop joints, with the depth first index of
+	// body0 in mDepthFirstParents and of body1 in mSubtreeEnds.
+	uint32_t			mBodyCount{ 0 };
+	uint32_t			*mDepthFirstBodies{ nullptr };
+	uint32_t			*mDepthFirstParents{ nullptr };
+	uint32_t			*mDepthFirstJoints{ nullptr };
+	uint32_t			*mSubtreeEnds{ nullptr };
+	uint32_t			*mAncestorTable{ nullptr };	// Only with path queries; levels of mNodeCount entries
+	const NameTable		*mBodyNames{ nullptr };
+	const NameTable		*mJointNames{ nullptr };
+};
+
+typedef std::vector< Hierarchy *> HierarchyVector;
+
+// Thin HierarchyLink adapter over one node of the flat hierarchy storage
+class Link : public HierarchyLink
+{
+public:
+	virtual void printChain(uint32_t depth) const override final
+	{
+		mHierarchy->printChain(mNode, depth);
+	}
+
+	// Return the number of children links
+	virtual uint32_t getChildCount(void) const override final
+	{
+		return mHierarchy->mChildOffsets[mNode + 1] - mHierarchy->mChildOffsets[mNode];
+	}
+
+	// Returns the name of the joint and bodies for this child
+	virtual const char *getJoint(uint32_t index, const char *&body0, const char *&body1, bool &isLoopJoint) const override final
+	{
+		const char *ret = nullptr;
+
+		if (index < getChildCount())
+		{
+			const Hierarchy &h = *mHierarchy;
+			uint32_t child = h.mChildOffsets[mNode] + index;	// Get this child
+			ret = h.mJointNames->getName(h.mJoints[child]);		// Get the name of this joint
+			body0 = h.mBodyNames->getName(h.mRigidBodies[mNode]);	// Get parent rigid body name
+			body1 = h.mBodyNames->getName(h.mRigidBodies[child]);	// get child rigid body name
+			isLoopJoint = h.mLoopJoints[child] ? true : false;	// Set flag to indicate if this is a loop joint
+		}
+
+		return ret;
+	}
+
+	// Returns this child hierarchy link
+	virtual const HierarchyLink *getChild(uint32_t index) const override final
+	{
+		const HierarchyLink *ret = nullptr;
+
+		if (index < getChildCount())
+		{
+			ret = static_cast<const HierarchyLink *>(&mHierarchy->mLinks[mHierarchy->mChildOffsets[mNode] + index]);
+		}
+
+		return ret;
+	}
+
+	virtual const char *getRigidBody(void) const override final
+	{
+		return mHierarchy->mBodyNames->getName(mHierarchy->mRigidBodies[mNode]);
+	}
+
+	virtual uint32_t getRigidBodyIndex(void) const override final
+	{
+		return mHierarchy->mRigidBodies[mNode];
+	}
+
+	// Returns the index of the joint and bodies for this child
+	virtual uint32_t getJointIndex(uint32_t index, uint32_t &body0, uint32_t &body1, bool &isLoopJoint) const override final
+	{
+		uint32_t ret = INVALID_INDEX;
+
+		if (index < getChildCount())
+		{
+			const Hierarchy &h = *mHierarchy;
+			uint32_t child = h.mChildOffsets[mNode] + index;
+			ret = h.mJoints[child];
+			body0 = h.mRigidBodies[mNode];
+			body1 = h.mRigidBodies[child];
+			isLoopJoint = h.mLoopJoints[child] ? true : false;
+		}
+
+		return ret;
+	}
+
+	const Hierarchy	*mHierarchy{ nullptr };
+	uint32_t		mNode{ 0 };	// Node index within the hierarchy
+};
+
+
+// Disjoint set (union-find) over rigid body indices, used to discover the connected components
+class DisjointSet
+{
+public:
+	void init(uint32_t count)
+	{
+		mParent.resize(count);
+		mRank.assign(count, 0);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			mParent[i] = i;
+		}
+	}
+
+	uint32_t find(uint32_t i)
+	{
+		while (mParent[i] != i)
+		{
+			mParent[i] = mParent[mParent[i]]; // path halving
+			i = mParent[i];
+		}
+		return i;
+	}
+
+	void unite(uint32_t a, uint32_t b)
+	{
+		a = find(a);
+		b = find(b);
+		if (a != b)
+		{
+			if (mRank[a] < mRank[b])
+			{
+				uint32_t t = a;
+				a = b;
+				b = t;
+			}
+			mParent[b] = a;
+			if (mRank[a] == mRank[b])
+			{
+				mRank[a]++;
+			}
+		}
+	}
+
+	IndexVector	mParent;
+	ByteVector	mRank;
+};
+
+// One entry on the explicit stack used to build a hierarchy depth first
+class TreeFrame
+{
+public:
+	uint32_t	mNode;		// Node in creation order
+	uint32_t	mBody;
+	uint32_t	mCursor;	// Next joint to visit for this body
+	bool		mIncoming;	// True once the outgoing joints have all been visited
+};
+
+typedef std::vector< TreeFrame > TreeFrameVector;
+
+// Scratch state used to build one hierarchy at a time; each build task has its own
+class TreeScratch
+{
+public:
+	IndexVector			mPath;
+	TreeFrameVector		mStack;
+	IndexVector			mParents;		// Parent of each node of the tree being built, in creation order
+	IndexVector			mRigidBodies;
+	IndexVector			mJoints;
+	IndexVector			mChildStart;
+	IndexVector			mChildren;
+	IndexVector			mOrder;
+	ByteVector			mLoopNodes;		// Non-zero for nodes which reach a rigid body already in the tree, in creation order
+	IndexVector			mHeights;		// Used to find the center of the tree
+	IndexVector			mSecondHeights;
+	IndexVector			mTallestChild;
+	IndexVector			mUpHeights;
+	IndexVector			mDepthFirst;	// Depth first index of each node which is not a loop node, in creation order
+#if HIERARCHY_BUILDER_STATS
+	uint64_t			mRootSteps{ 0 };
+	uint64_t			mTraversalSteps{ 0 };
+	uint32_t			mLoopJointCount{ 0 };
+#endif
+};
+
+typedef std::vector< TreeScratch > TreeScratchVector;
+
+// Runs the tasks of a parallel build on internal threads.  Each worker repeatedly claims the
+// next unstarted task, so threads which finish early keep taking work from the others.
+class ThreadScheduler : public HierarchyTaskScheduler
+{
+public:
+	ThreadScheduler(uint32_t threadCount) : mThreadCount(threadCount)
+	{
+	}
+
+	virtual void parallelFor(uint32_t count, HierarchyTask task, void *userData) override final
+	{
+		std::atomic< uint32_t > next(0);
+		auto worker = [&next, count, task, userData]()
+		{
+			for (uint32_t i = next++; i < count; i = next++)
+			{
+				task(userData, i);
+			}
+		};
+		uint32_t threadCount = mThreadCount < count ? mThreadCount : count;
+		std::vector< std::thread > threads;
+		threads.reserve(threadCount);
+		for (uint32_t i = 1; i < threadCount; i++)
+		{
+			threads.push_back(std::thread(worker));
+		}
+		worker(); // the calling thread works too
+		for (auto &i : threads)
+		{
+			i.join();
+		}
+	}
+
+	uint32_t	mThreadCount;
+};
+
+// Snapshot file layout.  The header is followed by sections of fixed size integers in the byte order of the
+// machine which wrote the file, each at a 4 byte aligned offset from the start of the file, so the file is
+// used in place wherever it is mapped.
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_REMOVED 0xFFFFFFFF	// String table offset of a removed rigid body or joint
+
+static const char gSnapshotMagic[8] = { 'H', 'B', 'S', 'N', 'A', 'P', 'S', 'H' };
+
+class SnapshotHeader
+{
+public:
+	char		mMagic[8];
+	uint32_t	mVersion;
+	uint32_t	mByteOrder;			// SNAPSHOT_BYTE_ORDER as written by the saving machine
+	uint64_t	mFileSize;
+	uint32_t	mRigidBodyCount;
+	uint32_t	mJointCount;
+	uint32_t	mHierarchyCount;
+	uint32_t	mDisconnectedCount;
+	uint32_t	mNodeCount;			// Total over every hierarchy
+	uint32_t	mStringsSize;
+	// Section offsets
+	uint64_t	mStrings;			// Null terminated names; offset 0 is the empty name
+	uint64_t	mBodyNames;			// String table offset of each rigid body's name
+	uint64_t	mJoints;			// SnapshotJoint for each joint
+	uint64_t	mHierarchies;		// SnapshotHierarchy for each hierarchy
+	uint64_t	mNodeRigidBodies;	// mNodeCount entries, the hierarchies one after another
+	uint64_t	mNodeJoints;		// mNodeCount entries
+	uint64_t	mChildOffsets;		// mNodeCount + mHierarchyCount entries, one extra per hierarchy
+	uint64_t	mLoopJoints;		// mNodeCount bytes
+	uint64_t	mDisconnected;		// Handle of each disconnected rigid body
+};
+
+// Header of a build result stored in a HierarchyCache.  It is followed by uint32_t arrays: the node count
+// of each hierarchy, the body count of each hierarchy if the depth first layout is included, the rigid
+// bodies, joints and child offsets of every node as in a snapshot, the four depth first arrays of every
+// node if included, the disconnected rigid bodies and finally the loop joint flag of every node.
+class CachedResultHeader
+{
+public:
+	char			mMagic[8];
+	uint32_t		mVersion;
+	uint32_t		mRigidBodyCount;
+	uint32_t		mJointCount;
+	uint32_t		mHierarchyCount;
+	uint32_t		mNodeCount;			// Total over every hierarchy
+	uint32_t		mDisconnectedCount;
+	uint32_t		mDepthFirst;		// Non-zero if the depth first layout is included
+	uint32_t		mPad{ 0 };
+	HierarchyKey	mKey;
+};
+
+#define CACHED_RESULT_VERSION 2
+
+static const char gCachedResultMagic[8] = { 'H', 'B', 'R', 'E', 'S', 'U', 'L', 'T' };
+
+class SnapshotJoint
+{
+public:
+	uint32_t	mName;		// String table offset
+	uint32_t	mBody0;
+	uint32_t	mBody1;
+};
+
+class SnapshotHierarchy
+{
+public:
+	uint32_t	mFirstNode;	// The child offsets of hierarchy 'i' start at mFirstNode + i
+	uint32_t	mNodeCount;
+};
+
+// Writes sections sequentially, tracking the offset so the layout can be computed with the same calls
+class SnapshotWriter
+{
+public:
+	SnapshotWriter(FILE *fph) : mFile(fph)
+	{
+	}
+
+	void write(const void *data, size_t size)
+	{
+		if (mFile && size)
+		{
+			fwrite(data, size, 1, mFile);
+		}
+		mOffset += size;
+	}
+
+	void align(void)
+	{
+		static const uint8_t zero[4] = { 0, 0, 0, 0 };
+		write(zero, size_t((4 - (mOffset & 3)) & 3));
+	}
+
+	FILE		*mFile;		// Null while only computing the layout
+	uint64_t	mOffset{ 0 };
+};
+
+class HierarchyBuilderImpl : public HierarchyBuilder
+{
+public:
+	HierarchyBuilderImpl(HierarchyAllocator *allocator, uint32_t flags) : mArena(allocator), mFlags(flags)
+	{
+		mBodyNames.setBorrowNames((flags & HBF_BORROW_NAMES) != 0);
+		mJointNames.setBorrowNames((flags & HBF_BORROW_NAMES) != 0);
+		mBodyNames.setCompressNames((flags & HBF_COMPRESS_NAMES) != 0);
+		mJointNames.setCompressNames((flags & HBF_COMPRESS_NAMES) != 0);
+
+	}
+
+	virtual ~HierarchyBuilderImpl(void)
+	{
+		reset();
+	}
+
+	virtual void reset(void) override final	// reset back to initial state
+	{
+		releaseHierarchies();
+		mBuilt = false;
+		mBodyNames.clear();
+		mJointNames.clear();
+		mRigidBodies.clear();
+		mJoints.clear();
+		mDisconnectedRigidBodies.clear();
+		mInputHash = InputHash();
+	}
+
+	virtual uint32_t getFlags(void) const override final
+	{
+		return mFlags;
+	}
+
+	virtual bool addRigidBody(const char *id) override final	// add a reference to a rigid body by name
+	{
+		bool ret = false;
+
+		uint32_t body = mBodyNames.insert(id);
+		if (body != INVALID_INDEX)
+		{
+			rigidBodyAdded();
+			ret = true;
+		}
+
+		return ret;
+	}
+
+	virtual uint32_t addRigidBody(void) override final
+	{
+		uint32_t ret = mBodyNames.insertUnnamed();
+		rigidBodyAdded();
+		return ret;
+	}
+
+	void rigidBodyAdded(void)
+	{
+		uint32_t body = uint32_t(mRigidBodies.size());
+		if (mBodyNames.isUnnamed(body))
+		{
+			mInputHash.addValue(INPUT_UNNAMED_RIGID_BODY);
+		}
+		else
+		{
+			mInputHash.addValue(INPUT_RIGID_BODY);
+			mInputHash.addBytes(mBodyNames.getScratchName(body), mBodyNames.getNameLength(body));
+		}
+		mRigidBodies.push_back(RigidBodyRef());
+		if (mBuilt)
+		{
+			// A new rigid body is not referenced by any joint yet
+			addDisconnected(uint32_t(mRigidBodies.size() - 1));
+		}
+	}
+
+	bool isLiveRigidBody(uint32_t body) const
+	{
+		return body < mRigidBodies.size() && !mRigidBodies[body].mRemoved;
+	}
+
+	virtual uint32_t addJoint(uint32_t body0, uint32_t body1) override final
+	{
+		uint32_t ret = INVALID_INDEX;
+
+		if (isLiveRigidBody(body0) && isLiveRigidBody(body1))
+		{
+			ret = mJointNames.insertUnnamed();
+			jointAdded(body0, body1);
+		}
+
+		return ret;
+	}
+
+	virtual uint32_t addJoint(const char *jointId, uint32_t body0, uint32_t body1) override final
+	{
+		uint32_t ret = INVALID_INDEX;
+
+		if (isLiveRigidBody(body0) && isLiveRigidBody(body1))
+		{
+			ret = mJointNames.insert(jointId);
+			if (ret != INVALID_INDEX)
+			{
+				jointAdded(body0, body1);
+			}
+		}
+
+		return ret;
+	}
+
+	virtual bool addJoint(const char *jointId,const char *body0, const char *body1) override final // add a reference to a joint that connects two rigid bodies
+	{
+		bool ret = false;
+
+		if (mJointNames.find(jointId) == INVALID_INDEX)
+		{
+			// We cannot add a joint unless it refers to known existing rigid bodies
+			uint32_t b0 = mBodyNames.find(body0);
+			uint32_t b1 = mBodyNames.find(body1);
+			if (b0 != INVALID_INDEX && b1 != INVALID_INDEX)
+			{
+				mJointNames.insert(jointId);
+				jointAdded(b0, b1);
+				ret = true;
+			}
+		}
+
+		return ret;
+	}
+
+	void jointAdded(uint32_t body0, uint32_t body1)
+	{
+		appendJoint(body0, body1);
+		if (mBuilt)
+		{
+			uint32_t seeds[2] = { body0, body1 };
+			updateComponents(seeds, 2);
+		}
+	}
+
+	void appendJoint(uint32_t body0, uint32_t body1)
+	{
+		uint32_t joint = uint32_t(mJoints.size());
+		if (mJointNames.isUnnamed(joint))
+		{
+			mInputHash.addValue(INPUT_UNNAMED_JOINT);
+		}
+		else
+		{
+			mInputHash.addValue(INPUT_JOINT);
+			mInputHash.addBytes(mJointNames.getScratchName(joint), mJointNames.getNameLength(joint));
+		}
+		mInputHash.addValue((uint64_t(body0) << 32) | body1);
+		JointRef j;
+		j.mBody0 = body0;
+		j.mBody1 = body1;
+		mJoints.push_back(j);
+		linkJoint(joint);
+	}
+
+	virtual void reserve(uint32_t bodyCount, uint32_t jointCount) override final
+	{
+		mBodyNames.reserve(bodyCount);
+		mRigidBodies.reserve(bodyCount);
+		mJointNames.reserve(jointCount);
+		mJoints.reserve(jointCount);
+	}
+
+	virtual uint32_t addRigidBodies(const char * const *ids, uint32_t count) override final
+	{
+		uint32_t ret = 0;
+
+		reserve(mBodyNames.size() + count, uint32_t(mJoints.size()));
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (mBodyNames.insert(ids[i]) != INVALID_INDEX)
+			{
+				rigidBodyAdded();
+				ret++;
+			}
+		}
+
+		return ret;
+	}
+
+	virtual uint32_t addJoints(const char * const *jointIds, const char * const *body0, const char * const *body1, uint32_t count) override final
+	{
+		uint32_t ret = 0;
+
+		reserve(mBodyNames.size(), mJointNames.size() + count);
+		mSeeds.clear();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			// Resolve the bodies first so the joint name is only hashed once, by the insert
+			uint32_t b0 = mBodyNames.find(body0[i]);
+			uint32_t b1 = mBodyNames.find(body1[i]);
+			if (b0 != INVALID_INDEX && b1 != INVALID_INDEX && mJointNames.insert(jointIds[i]) != INVALID_INDEX)
+			{
+				appendJoint(b0, b1);
+				mSeeds.push_back(b0);
+				mSeeds.push_back(b1);
+				ret++;
+			}
+		}
+		batchAdded();
+
+		return ret;
+	}
+
+	virtual uint32_t addJoints(const uint32_t *body0, const uint32_t *body1, uint32_t count) override final
+	{
+		uint32_t ret = 0;
+
+		reserve(mBodyNames.size(), mJointNames.size() + count);
+		mSeeds.clear();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (isLiveRigidBody(body0[i]) && isLiveRigidBody(body1[i]))
+			{
+				mJointNames.insertUnnamed();
+				appendJoint(body0[i], body1[i]);
+				mSeeds.push_back(body0[i]);
+				mSeeds.push_back(body1[i]);
+				ret++;
+			}
+		}
+		batchAdded();
+
+		return ret;
+	}
+
+	// After a build, a whole batch of joints is applied with a single incremental update
+	void batchAdded(void)
+	{
+		if (mBuilt && !mSeeds.empty())
+		{
+			updateComponents(&mSeeds[0], uint32_t(mSeeds.size()));
+		}
+	}
+
+	// Append a joint to the outgoing list of body0 and the incoming list of body1
+	void linkJoint(uint32_t joint)
+	{
+		JointRef &j = mJoints[joint];
+		RigidBodyRef &b0 = mRigidBodies[j.mBody0];
+		j.mPrevOut = b0.mLastOut;
+		if (b0.mLastOut == INVALID_INDEX)
+		{
+			b0.mFirstOut = joint;
+		}
+		else
+		{
+			mJoints[b0.mLastOut].mNextOut = joint;
+		}
+		b0.mLastOut = joint;
+		b0.mDegree++;
+		RigidBodyRef &b1 = mRigidBodies[j.mBody1];
+		j.mPrevIn = b1.mLastIn;
+		if (b1.mLastIn == INVALID_INDEX)
+		{
+			b1.mFirstIn = joint;
+		}
+		else
+		{
+			mJoints[b1.mLastIn].mNextIn = joint;
+		}
+		b1.mLastIn = joint;
+		b1.mDegree++;
+	}
+
+	void unlinkJoint(uint32_t joint)
+	{
+		JointRef &j = mJoints[joint];
+		RigidBodyRef &b0 = mRigidBodies[j.mBody0];
+		if (j.mPrevOut == INVALID_INDEX)
+		{
+			b0.mFirstOut = j.mNextOut;
+		}
+		else
+		{
+			mJoints[j.mPrevOut].mNextOut = j.mNextOut;
+		}
+		if (j.mNextOut == INVALID_INDEX)
+		{
+			b0.mLastOut = j.mPrevOut;
+		}
+		else
+		{
+			mJoints[j.mNextOut].mPrevOut = j.mPrevOut;
+		}
+		b0.mDegree--;
+		RigidBodyRef &b1 = mRigidBodies[j.mBody1];
+		if (j.mPrevIn == INVALID_INDEX)
+		{
+			b1.mFirstIn = j.mNextIn;
+		}
+		else
+		{
+			mJoints[j.mPrevIn].mNextIn = j.mNextIn;
+		}
+		if (j.mNextIn == INVALID_INDEX)
+		{
+			b1.mLastIn = j.mPrevIn;
+		}
+		else
+		{
+			mJoints[j.mNextIn].mPrevIn = j.mPrevIn;
+		}
+		b1.mDegree--;
+		j.mNextOut = j.mPrevOut = j.mNextIn = j.mPrevIn = INVALID_INDEX;
+	}
+
+	virtual bool removeJoint(uint32_t joint) override final
+	{
+		bool ret = false;
+
+		if (joint < mJoints.size() && !mJoints[joint].mRemoved)
+		{
+			JointRef &j = mJoints[joint];
+			unlinkJoint(joint);
+			j.mRemoved = true;
+			mJointNames.erase(joint);
+			mInputHash.addValue(INPUT_REMOVE_JOINT);
+			mInputHash.addValue(joint);
+			if (mBuilt)
+			{
+				uint32_t seeds[2] = { j.mBody0, j.mBody1 };
+				updateComponents(seeds, 2);
+			}
+			ret = true;
+		}
+
+		return ret;
+	}
+
+	virtual bool removeRigidBody(uint32_t body) override final
+	{
+		bool ret = false;
+
+		if (isLiveRigidBody(body))
+		{
+			// Remove every joint which references this body; the bodies on the other side of
+			// them seed the update, along with this body in case it only had joints to itself
+			mSeeds.clear();
+			mSeeds.push_back(body);
+			RigidBodyRef &b = mRigidBodies[body];
+			while (b.mFirstOut != INVALID_INDEX || b.mFirstIn != INVALID_INDEX)
+			{
+				uint32_t joint = b.mFirstOut != INVALID_INDEX ? b.mFirstOut : b.mFirstIn;
+				JointRef &j = mJoints[joint];
+				mSeeds.push_back(j.mBody0 == body ? j.mBody1 : j.mBody0);
+				unlinkJoint(joint);
+				j.mRemoved = true;
+				mJointNames.erase(joint);
+			}
+			b.mRemoved = true;
+			mBodyNames.erase(body);
+			mInputHash.addValue(INPUT_REMOVE_RIGID_BODY);
+			mInputHash.addValue(body);
+			if (mBuilt)
+			{
+				removeDisconnected(body);
+				updateComponents(&mSeeds[0], uint32_t(mSeeds.size()));
+			}
+			ret = true;
+		}
+
+		return ret;
+	}
+
+	virtual uint32_t getRigidBodyHandle(const char *id) override final
+	{
+		return mBodyNames.find(id);
+	}
+
+	virtual uint32_t getJointHandle(const char *jointId) override final
+	{
+		return mJointNames.find(jointId);
+	}
+
+	// Build the hierarchy and return the number of unique hierarchies found
+	virtual uint32_t build(void) override final
+	{
+		BuildOptions options;
+		return build(options);
+	}
+
+	// Build the hierarchy and return the number of unique hierarchies found
+	virtual uint32_t build(const BuildOptions &options) override final
+	{
+		HB_STAT(Timer timer);
+		HB_STAT(Timer total);
+		HB_STAT(mStats = BuildStats());
+		HB_STAT(mLazyHierarchyCount = 0);
+		releaseHierarchies();
+		HB_STAT(mStats.mReleaseTime = timer.lap());
+		bool restored = false;
+		HierarchyKey key;
+		if (options.mCache)
+		{
+			key = getResultKey(options);
+			const void *data;
+			size_t size;
+			restored = options.mCache->find(key, data, size) && restoreResult(options, key, data, size);
+			HB_STAT(mStats.mCacheHit = restored);
+			HB_STAT(mStats.mCacheTime = timer.lap());
+		}
+		if (!restored)
+		{
+			buildFromInputs(options);
+			if (options.mCache)
+			{
+				HB_STAT(timer.lap());
+				writeResult(key);
+				options.mCache->store(key, &mResultData[0], mResultData.size());
+				HB_STAT(mStats.mCacheTime += timer.lap());
+			}
+		}
+#if HIERARCHY_BUILDER_STATS
+		mStats.mTotalTime = total.lap();
+		updatePeakBytes();
+#endif
+#if LOG_CHAIN
+		for (auto &i : mHierarchies)
+		{
+			materialize(i);
+			i->debugPrint();
+		}
+#endif
+		mBuilt = true;
+
+		return uint32_t(mHierarchies.size());
+	}
+
+	// Runs every phase of the build on the current inputs
+	void buildFromInputs(const BuildOptions &options)
+	{
+		HB_STAT(Timer timer);
+		// Identify all rigid bodies which are not referenced by any joint
+		// and add them to the disconnected rigid bodies list
+		checkForDisconnectedRigidBodies();
+		HB_STAT(mStats.mDisconnectedTime = timer.lap());
+		// Find the connected components with a disjoint set over the rigid body indices.
+		// Components are numbered in the order their first joint was defined so that the
+		// hierarchy order is deterministic.
+		findComponents();
+		HB_STAT(mStats.mComponentTime = timer.lap());
+		setRootPolicy(options);
+		mPathQueries = options.mPathQueries;
+		mDepthFirstView = options.mDepthFirstView || mPathQueries;
+		findSharedStructure(options);
+		HB_STAT(mStats.mShareTime = timer.lap());
+		// Every joint produces exactly one node and each component adds a root node, so the
+		// flat node storage for all hierarchies can be sized up front and every hierarchy
+		// knows where its nodes go before any of them are built.  A hierarchy which shares the
+		// structure of an earlier one only needs storage for its own handles.
+		uint32_t nodeCount = uint32_t(mComponentJoints.size()) + mComponentCount;
+		uint32_t structureNodeCount = nodeCount;
+		uint32_t structureCount = mComponentCount;
+		if (!mTemplates.empty())
+		{
+			structureNodeCount = 0;
+			structureCount = 0;
+			for (uint32_t i = 0; i < mComponentCount; i++)
+			{
+				if (mTemplates[i] == i)
+				{
+					structureNodeCount += mComponentStart[i + 1] - mComponentStart[i] + 1;
+					structureCount++;
+				}
+			}
+		}
+		uint32_t *nodeRigidBodies = mArena.allocArray< uint32_t >(nodeCount);
+		uint32_t *nodeJoints = mArena.allocArray< uint32_t >(nodeCount);
+		uint32_t *nodeChildOffsets = mArena.allocArray< uint32_t >(structureNodeCount + structureCount); // One more entry per hierarchy
+		uint8_t *nodeLoopJoints = mArena.allocArray< uint8_t >(structureNodeCount);
+		Link *links = mArena.allocArray< Link >(nodeCount);
+		if (!options.mLazy)
+		{
+			memset(nodeLoopJoints, 0, structureNodeCount);
+			for (uint32_t i = 0; i < nodeCount; i++)
+			{
+				new (&links[i]) Link;
+			}
+		}
+		uint32_t *depthFirst = nullptr;
+		uint32_t *depthFirstStructure = nullptr;
+		uint32_t *ancestorTable = nullptr;
+		if (mDepthFirstView)
+		{
+			depthFirst = mArena.allocArray< uint32_t >(size_t(nodeCount) * 2);
+			depthFirstStructure = mArena.allocArray< uint32_t >(size_t(structureNodeCount) * 2);
+			mDepthFirstIndices.resize(mRigidBodies.size());
+		}
+		if (mPathQueries)
+		{
+			// The ancestor table depends only on the structure, so it is shared along with it
+			size_t ancestorTableSize = 0;
+			for (uint32_t i = 0; i < mComponentCount; i++)
+			{
+				if (mTemplates.empty() || mTemplates[i] == i)
+				{
+					ancestorTableSize += Hierarchy::getAncestorTableSize(mComponentStart[i + 1] - mComponentStart[i] + 1);
+				}
+			}
+			ancestorTable = mArena.allocArray< uint32_t >(ancestorTableSize);
+		}
+		mHierarchies.reserve(mComponentCount);
+		uint32_t structureNode = 0;
+		uint32_t structure = 0;
+		for (uint32_t i = 0; i < mComponentCount; i++)
+		{
+			uint32_t firstNode = mComponentStart[i] + i;
+			Hierarchy *h = new (mArena.alloc(sizeof(Hierarchy))) Hierarchy(mHierarchies.size());
+			h->mNodeCount		= mComponentStart[i + 1] - mComponentStart[i] + 1;
+			h->mRigidBodies		= &nodeRigidBodies[firstNode];
+			h->mJoints			= &nodeJoints[firstNode];
+			h->mLinks			= &links[firstNode];
+			h->mBodyNames		= &mBodyNames;
+			h->mJointNames		= &mJointNames;
+			if (depthFirst)
+			{
+				h->mDepthFirstBodies	= &depthFirst[firstNode];
+				h->mDepthFirstJoints	= &depthFirst[nodeCount + firstNode];
+			}
+			if (mTemplates.empty() || mTemplates[i] == i)
+			{
+				h->mLoopJoints		= &nodeLoopJoints[structureNode];
+				h->mChildOffsets	= &nodeChildOffsets[structureNode + structure];
+				if (depthFirstStructure)
+				{
+					h->mDepthFirstParents	= &depthFirstStructure[structureNode];
+					h->mSubtreeEnds			= &depthFirstStructure[structureNodeCount + structureNode];
+				}
+				if (ancestorTable)
+				{
+					h->mAncestorTable		= ancestorTable;
+					ancestorTable += Hierarchy::getAncestorTableSize(h->mNodeCount);
+				}
+				structureNode += h->mNodeCount;
+				structure++;
+			}
+			else
+			{
+				const Hierarchy *t = mHierarchies[mTemplates[i]];
+				h->mLoopJoints			= t->mLoopJoints;
+				h->mChildOffsets		= t->mChildOffsets;
+				h->mDepthFirstParents	= t->mDepthFirstParents;
+				h->mSubtreeEnds			= t->mSubtreeEnds;
+				h->mAncestorTable		= t->mAncestorTable;
+			}
+			if (options.mLazy)
+			{
+				// Updates find the hierarchy of each rigid body before the hierarchy itself is built
+				h->mMaterialized	= false;
+				h->mLazyJoints		= &mComponentJoints[mComponentStart[i]];
+				h->mLazyJointCount	= mComponentStart[i + 1] - mComponentStart[i];
+				for (uint32_t k = 0; k < h->mLazyJointCount; k++)
+				{
+					const JointRef &j = mJoints[h->mLazyJoints[k]];
+					mRigidBodies[j.mBody0].mHierarchy = h;
+					mRigidBodies[j.mBody1].mHierarchy = h;
+				}
+			}
+			mHierarchies.push_back(h);
+		}
+		HB_STAT(mStats.mAllocateTime = timer.lap());
+		// Each component is turned into a single hierarchy with one depth first traversal.
+		// Components share no data, so they are split into tasks which may run concurrently.
+		mVisited.assign(mRigidBodies.size(), 0);
+		mJointVisited.assign(mJoints.size(), 0);
+		mJointNodes.resize(mJoints.size());
+		if (options.mLazy)
+		{
+			// Each hierarchy is built by materialize() when it is first looked at
+			if (mScratch.empty())
+			{
+				mScratch.resize(1);
+			}
+		}
+		else
+		{
+			uint32_t threadCount = options.mThreadCount ? options.mThreadCount : std::thread::hardware_concurrency();
+			uint32_t taskCount = (threadCount > 1 || options.mTaskScheduler) ? threadCount * TASKS_PER_THREAD : 1;
+			splitTasks(taskCount);
+			if (mScratch.size() < mTaskStart.size() - 1)
+			{
+				mScratch.resize(mTaskStart.size() - 1);
+			}
+#if HIERARCHY_BUILDER_STATS
+			for (auto &i : mScratch)
+			{
+				i.mRootSteps = 0;
+				i.mTraversalSteps = 0;
+				i.mLoopJointCount = 0;
+			}
+#endif
+			runTasks(buildTask, options, threadCount);
+			if (!mTemplates.empty() && structureCount < mComponentCount)
+			{
+				// The remaining hierarchies copy the structure of the ones just built
+				runTasks(shareTask, options, threadCount);
+			}
+#if HIERARCHY_BUILDER_STATS
+			mStats.mTaskCount = uint32_t(mTaskStart.size() - 1);
+			for (auto &i : mScratch)
+			{
+				mStats.mRootSteps += i.mRootSteps;
+				mStats.mTraversalSteps += i.mTraversalSteps;
+				mStats.mLoopJointCount += i.mLoopJointCount;
+			}
+#endif
+		}
+#if HIERARCHY_BUILDER_STATS
+		mStats.mTreeTime = timer.lap();
+		mStats.mRigidBodyCount = uint32_t(mRigidBodies.size());
+		mStats.mJointCount = uint32_t(mComponentJoints.size());
+		mStats.mComponentCount = mComponentCount;
+#endif
+	}
+
+	// Builds a hierarchy of a lazy build the first time it is looked at.  The flag is checked again under the
+	// lock, so concurrent first lookups build it exactly once and all of them see the finished hierarchy.
+	void materialize(Hierarchy *h) const
+	{
+		if (!h->mMaterialized.load(std::memory_order_acquire))
+		{
+			std::lock_guard< std::mutex > lock(mLazyMutex);
+			if (!h->mMaterialized.load(std::memory_order_relaxed))
+			{
+				const_cast<HierarchyBuilderImpl *>(this)->buildLazyHierarchy(h);
+				h->mMaterialized.store(true, std::memory_order_release);
+			}
+		}
+	}
+
+	// Called with mLazyMutex held, which also guards the statistics merged here when they are compiled in
+	void buildLazyHierarchy(Hierarchy *h)
+	{
+		memset(h->mLoopJoints, 0, h->mNodeCount);
+		for (uint32_t i = 0; i < h->mNodeCount; i++)
+		{
+			new (&h->mLinks[i]) Link;
+		}
+		TreeScratch &s = mScratch[0];
+#if HIERARCHY_BUILDER_STATS
+		s.mRootSteps = 0;
+		s.mTraversalSteps = 0;
+		s.mLoopJointCount = 0;
+#endif
+		buildHierarchy(s, h, h->mLazyJoints, h->mLazyJointCount);
+#if HIERARCHY_BUILDER_STATS
+		mStats.mRootSteps += s.mRootSteps;
+		mStats.mTraversalSteps += s.mTraversalSteps;
+		mStats.mLoopJointCount += s.mLoopJointCount;
+		mLazyHierarchyCount++;
+#endif
+	}
+
+	void materializeAll(void)
+	{
+		for (auto &i : mHierarchies)
+		{
+			materialize(i);
+		}
+	}
+
+	// Return the hierarchy holding a rigid body, with the depth first index of the body in it; nullptr if the
+	// body is in no hierarchy or the depth first layout was not built
+	const Hierarchy *findDepthFirstIndex(uint32_t body, uint32_t &index) const
+	{
+		const Hierarchy *ret = nullptr;
+
+		if (body < mRigidBodies.size() && mRigidBodies[body].mHierarchy && mRigidBodies[body].mHierarchy->mDepthFirstBodies)
+		{
+			ret = mRigidBodies[body].mHierarchy;
+			materialize(mRigidBodies[body].mHierarchy);
+			index = mDepthFirstIndices[body];
+		}
+
+		return ret;
+	}
+
+	// The cache key is the input hash extended with every build option which changes the result
+	HierarchyKey getResultKey(const BuildOptions &options) const
+	{
+		InputHash hash = mInputHash;
+		hash.addValue(INPUT_BUILD_OPTIONS);
+		hash.addValue(options.mRootPolicy);
+		hash.addValue(options.mDepthFirstView || options.mPathQueries ? 1 : 0);
+		if (options.mRootPolicy == ROOT_SPECIFIED)
+		{
+			hash.addValue(options.mRootBodyCount);
+			for (uint32_t i = 0; i < options.mRootBodyCount; i++)
+			{
+				hash.addValue(options.mRootBodies[i]);
+			}
+		}
+		return hash.getKey();
+	}
+
+	virtual HierarchyKey getInputKey(void) const override final
+	{
+		return mInputHash.getKey();
+	}
+
+	// Serializes the current result into mResultData in the CachedResultHeader layout
+	void writeResult(const HierarchyKey &key)
+	{
+		materializeAll();
+		uint32_t hierarchyCount = uint32_t(mHierarchies.size());
+		uint32_t nodeCount = 0;
+		for (auto &i : mHierarchies)
+		{
+			nodeCount += i->mNodeCount;
+		}
+		size_t words = size_t(hierarchyCount) * 2 + size_t(nodeCount) * 3 + mDisconnectedRigidBodies.size();
+		if (mDepthFirstView)
+		{
+			words += hierarchyCount + size_t(nodeCount) * 4;
+		}
+		mResultData.resize(sizeof(CachedResultHeader) + words * sizeof(uint32_t) + nodeCount);
+		CachedResultHeader header;
+		memcpy(header.mMagic, gCachedResultMagic, sizeof(header.mMagic));
+		header.mVersion = CACHED_RESULT_VERSION;
+		header.mRigidBodyCount = uint32_t(mRigidBodies.size());
+		header.mJointCount = uint32_t(mJoints.size());
+		header.mHierarchyCount = hierarchyCount;
+		header.mNodeCount = nodeCount;
+		header.mDisconnectedCount = uint32_t(mDisconnectedRigidBodies.size());
+		header.mDepthFirst = mDepthFirstView ? 1 : 0;
+		header.mKey = key;
+		uint8_t *dest = &mResultData[0];
+		memcpy(dest, &header, sizeof(header));
+		dest += sizeof(header);
+		for (auto &i : mHierarchies)
+		{
+			dest = writeWords(dest, &i->mNodeCount, 1);
+		}
+		if (mDepthFirstView)
+		{
+			for (auto &i : mHierarchies)
+			{
+				dest = writeWords(dest, &i->mBodyCount, 1);
+			}
+		}
+		for (auto &i : mHierarchies)
+		{
+			dest = writeWords(dest, i->mRigidBodies, i->mNodeCount);
+		}
+		for (auto &i : mHierarchies)
+		{
+			dest = writeWords(dest, i->mJoints, i->mNodeCount);
+		}
+		for (auto &i : mHierarchies)
+		{
+			dest = writeWords(dest, i->mChildOffsets, i->mNodeCount + 1);
+		}
+		if (mDepthFirstView)
+		{
+			for (auto &i : mHierarchies)
+			{
+				dest = writeWords(dest, i->mDepthFirstBodies, i->mNodeCount);
+				dest = writeWords(dest, i->mDepthFirstParents, i->mNodeCount);
+				dest = writeWords(dest, i->mDepthFirstJoints, i->mNodeCount);
+				dest = writeWords(dest, i->mSubtreeEnds, i->mNodeCount);
+			}
+		}
+		if (!mDisconnectedRigidBodies.empty())
+		{
+			dest = writeWords(dest, &mDisconnectedRigidBodies[0], uint32_t(mDisconnectedRigidBodies.size()));
+		}
+		for (auto &i : mHierarchies)
+		{
+			memcpy(dest, i->mLoopJoints, i->mNodeCount);
+			dest += i->mNodeCount;
+		}
+	}
+
+	static uint8_t *writeWords(uint8_t *dest, const uint32_t *source, uint32_t count)
+	{
+		memcpy(dest, source, sizeof(uint32_t) * count);
+		return dest + sizeof(uint32_t) * count;
+	}
+
+	// Replaces the result with one written by writeResult.  The data is checked against the current inputs
+	// first and nothing is changed if it does not match, so a bad cache entry only costs a normal build.
+	bool restoreResult(const BuildOptions &options, const HierarchyKey &key, const void *data, size_t size)
+	{
+		bool ret = false;
+
+		CachedResultHeader header;
+		if (size >= sizeof(header))
+		{
+			memcpy(&header, data, sizeof(header));
+			uint32_t bodyCount = uint32_t(mRigidBodies.size());
+			uint32_t jointCount = uint32_t(mJoints.size());
+			uint32_t hierarchyCount = header.mHierarchyCount;
+			uint32_t nodeCount = header.mNodeCount;
+			bool depthFirst = header.mDepthFirst != 0;
+			size_t words = size_t(hierarchyCount) * 2 + size_t(nodeCount) * 3 + header.mDisconnectedCount;
+			if (depthFirst)
+			{
+				words += hierarchyCount + size_t(nodeCount) * 4;
+			}
+			if (memcmp(header.mMagic, gCachedResultMagic, sizeof(header.mMagic)) == 0 &&
+				header.mVersion == CACHED_RESULT_VERSION &&
+				header.mKey.mLow == key.mLow && header.mKey.mHigh == key.mHigh &&
+				header.mRigidBodyCount == bodyCount &&
+				header.mJointCount == jointCount &&
+				depthFirst == (options.mDepthFirstView || options.mPathQueries) &&
+				size == sizeof(header) + words * sizeof(uint32_t) + nodeCount)
+			{
+				const uint32_t *nodeCounts = reinterpret_cast<const uint32_t *>(static_cast<const uint8_t *>(data) + sizeof(header));
+				const uint32_t *bodyCounts = nodeCounts + hierarchyCount;
+				const uint32_t *rigidBodies = bodyCounts + (depthFirst ? hierarchyCount : 0);
+				const uint32_t *joints = rigidBodies + nodeCount;
+				const uint32_t *childOffsets = joints + nodeCount;
+				const uint32_t *depthFirstArrays = childOffsets + nodeCount + hierarchyCount;
+				const uint32_t *disconnected = depthFirstArrays + (depthFirst ? size_t(nodeCount) * 4 : 0);
+				const uint8_t *loopJoints = reinterpret_cast<const uint8_t *>(disconnected + header.mDisconnectedCount);
+				// Every handle and offset is checked, since the builder and the views index with them
+				bool valid = true;
+				uint32_t node = 0;
+				for (uint32_t i = 0; valid && i < hierarchyCount; i++)
+				{
+					uint32_t count = nodeCounts[i];
+					valid = count >= 2 && count <= nodeCount - node && (!depthFirst || bodyCounts[i] <= count);
+					// The children of every node follow it and the root's start at node 1, so each node other
+					// than the root has exactly one parent which comes before it and there can be no cycle
+					const uint32_t *offsets = childOffsets + node + i;
+					valid = valid && offsets[0] == 1;
+					for (uint32_t k = 0; valid && k < count; k++)
+					{
+						valid = isLiveRigidBody(rigidBodies[node + k]) &&
+							(k ? joints[node + k] < jointCount : joints[node + k] == INVALID_INDEX) &&
+							offsets[k] > k && offsets[k] <= offsets[k + 1] && offsets[k + 1] <= count;
+					}
+					valid = valid && offsets[count] == count;
+					// The path queries also index with the depth first bodies and parents
+					const uint32_t *depthFirstBodies = depthFirstArrays + size_t(node) * 4;
+					for (uint32_t k = 0; valid && depthFirst && k < bodyCounts[i]; k++)
+					{
+						uint32_t parent = depthFirstBodies[count + k];
+						valid = isLiveRigidBody(depthFirstBodies[k]) && (k ? parent < k : parent == INVALID_INDEX);
+					}
+					node += count;
+				}
+				for (uint32_t i = 0; valid && i < header.mDisconnectedCount; i++)
+				{
+					valid = isLiveRigidBody(disconnected[i]);
+				}
+				if (valid && node == nodeCount)
+				{
+					restoreHierarchies(options, header, nodeCounts, bodyCounts, rigidBodies, joints, childOffsets, depthFirstArrays, loopJoints);
+					for (uint32_t i = 0; i < header.mDisconnectedCount; i++)
+					{
+						addDisconnected(disconnected[i]);
+					}
+					ret = true;
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	void restoreHierarchies(const BuildOptions &options, const CachedResultHeader &header, const uint32_t *nodeCounts, const uint32_t *bodyCounts,
+		const uint32_t *rigidBodies, const uint32_t *joints, const uint32_t *childOffsets, const uint32_t *depthFirstArrays, const uint8_t *loopJoints)
+	{
+		uint32_t hierarchyCount = header.mHierarchyCount;
+		uint32_t nodeCount = header.mNodeCount;
+		setRootPolicy(options);
+		mPathQueries = options.mPathQueries;
+		mDepthFirstView = options.mDepthFirstView || mPathQueries;
+		mTemplates.clear();
+		mDisconnectedRigidBodies.clear();
+		for (auto &i : mRigidBodies)
+		{
+			i.mHierarchy = nullptr;
+			i.mDisconnectedSlot = INVALID_INDEX;
+		}
+		if (mDepthFirstView)
+		{
+			mDepthFirstIndices.resize(mRigidBodies.size());
+		}
+		// Left as a build would leave them, so incremental updates work the same afterwards
+		mVisited.assign(mRigidBodies.size(), 0);
+		mJointVisited.assign(mJoints.size(), 0);
+		mJointNodes.resize(mJoints.size());
+		uint32_t *nodeRigidBodies = mArena.allocArray< uint32_t >(nodeCount);
+		uint32_t *nodeJoints = mArena.allocArray< uint32_t >(nodeCount);
+		uint32_t *nodeChildOffsets = mArena.allocArray< uint32_t >(nodeCount + hierarchyCount);
+		uint8_t *nodeLoopJoints = mArena.allocArray< uint8_t >(nodeCount);
+		Link *links = mArena.allocArray< Link >(nodeCount);
+		uint32_t *depthFirst = mDepthFirstView ? mArena.allocArray< uint32_t >(size_t(nodeCount) * 4) : nullptr;
+		memcpy(nodeRigidBodies, rigidBodies, sizeof(uint32_t) * nodeCount);
+		memcpy(nodeJoints, joints, sizeof(uint32_t) * nodeCount);
+		memcpy(nodeChildOffsets, childOffsets, sizeof(uint32_t) * (nodeCount + hierarchyCount));
+		memcpy(nodeLoopJoints, loopJoints, nodeCount);
+		mHierarchies.reserve(hierarchyCount);
+		uint32_t firstNode = 0;
+		for (uint32_t i = 0; i < hierarchyCount; i++)
+		{
+			Hierarchy *h = new (mArena.alloc(sizeof(Hierarchy))) Hierarchy(i);
+			h->mNodeCount		= nodeCounts[i];
+			h->mRigidBodies		= &nodeRigidBodies[firstNode];
+			h->mJoints			= &nodeJoints[firstNode];
+			h->mLoopJoints		= &nodeLoopJoints[firstNode];
+			h->mChildOffsets	= &nodeChildOffsets[firstNode + i];
+			h->mLinks			= &links[firstNode];
+			h->mBodyNames		= &mBodyNames;
+			h->mJointNames		= &mJointNames;
+			if (depthFirst)
+			{
+				// Each hierarchy's four depth first arrays were written one after another
+				uint32_t *dest = &depthFirst[size_t(firstNode) * 4];
+				memcpy(dest, &depthFirstArrays[size_t(firstNode) * 4], sizeof(uint32_t) * 4 * h->mNodeCount);
+				h->mBodyCount			= bodyCounts[i];
+				h->mDepthFirstBodies	= dest;
+				h->mDepthFirstParents	= dest + h->mNodeCount;
+				h->mDepthFirstJoints	= dest + h->mNodeCount * 2;
+				h->mSubtreeEnds			= dest + h->mNodeCount * 3;
+				for (uint32_t k = 0; k < h->mBodyCount; k++)
+				{
+					mDepthFirstIndices[h->mDepthFirstBodies[k]] = k;
+				}
+				if (mPathQueries)
+				{
+					h->mAncestorTable = mArena.allocArray< uint32_t >(Hierarchy::getAncestorTableSize(h->mNodeCount));
+					h->buildAncestorTable();
+				}
+			}
+			for (uint32_t k = 0; k < h->mNodeCount; k++)
+			{
+				new (&h->mLinks[k]) Link;
+				h->mLinks[k].mHierarchy = h;
+				h->mLinks[k].mNode = k;
+				mRigidBodies[h->mRigidBodies[k]].mHierarchy = h;
+				HB_STAT(mStats.mLoopJointCount += h->mLoopJoints[k]);
+			}
+			mHierarchies.push_back(h);
+			firstNode += h->mNodeCount;
+		}
+#if HIERARCHY_BUILDER_STATS
+		mStats.mRigidBodyCount = uint32_t(mRigidBodies.size());
+		mStats.mJointCount = nodeCount - hierarchyCount;
+		mStats.mComponentCount = hierarchyCount;
+#endif
+	}
+
+	// Splits the components into at most 'taskCount' contiguous ranges with roughly the same number of joints
+	void splitTasks(uint32_t taskCount)
+	{
+		if (taskCount > mComponentCount)
+		{
+			taskCount = mComponentCount ? mComponentCount : 1;
+		}
+		uint64_t jointCount = mComponentJoints.size();
+		mTaskStart.clear();
+		mTaskStart.push_back(0);
+		uint32_t component = 0;
+		for (uint32_t i = 1; i < taskCount; i++)
+		{
+			uint64_t target = jointCount * i / taskCount;
+			while (component < mComponentCount && mComponentStart[component] < target)
+			{
+				component++;
+			}
+			if (component > mTaskStart.back())
+			{
+				mTaskStart.push_back(component);
+			}
+		}
+		mTaskStart.push_back(mComponentCount);
+	}
+
+	void runTasks(HierarchyTask task, const BuildOptions &options, uint32_t threadCount)
+	{
+		if (mTaskStart.size() == 2)
+		{
+			task(this, 0);
+		}
+		else if (options.mTaskScheduler)
+		{
+			options.mTaskScheduler->parallelFor(uint32_t(mTaskStart.size() - 1), task, this);
+		}
+		else
+		{
+			ThreadScheduler scheduler(threadCount);
+			scheduler.parallelFor(uint32_t(mTaskStart.size() - 1), task, this);
+		}
+	}
+
+	static void buildTask(void *userData, uint32_t task)
+	{
+		HierarchyBuilderImpl *hb = static_cast<HierarchyBuilderImpl *>(userData);
+		TreeScratch &s = hb->mScratch[task];
+		for (uint32_t i = hb->mTaskStart[task]; i < hb->mTaskStart[task + 1]; i++)
+		{
+			if (hb->mTemplates.empty() || hb->mTemplates[i] == i)
+			{
+				const uint32_t *joints = &hb->mComponentJoints[hb->mComponentStart[i]];
+				uint32_t jointCount = hb->mComponentStart[i + 1] - hb->mComponentStart[i];
+				hb->buildHierarchy(s, hb->mHierarchies[i], joints, jointCount);
+			}
+		}
+	}
+
+	static void shareTask(void *userData, uint32_t task)
+	{
+		HierarchyBuilderImpl *hb = static_cast<HierarchyBuilderImpl *>(userData);
+		TreeScratch &s = hb->mScratch[task];
+		for (uint32_t i = hb->mTaskStart[task]; i < hb->mTaskStart[task + 1]; i++)
+		{
+			uint32_t t = hb->mTemplates[i];
+			if (t != i)
+			{
+				const uint32_t *joints = &hb->mComponentJoints[hb->mComponentStart[i]];
+				const uint32_t *templateJoints = &hb->mComponentJoints[hb->mComponentStart[t]];
+				uint32_t jointCount = hb->mComponentStart[i + 1] - hb->mComponentStart[i];
+				hb->shareHierarchy(s, hb->mHierarchies[i], hb->mHierarchies[t], joints, templateJoints, jointCount);
+			}
+		}
+	}
+
+	// Components are compared by their joints in definition order, with each rigid body replaced by the order
+	// in which it first appears.  Two components which match build exactly the same hierarchy apart from the
+	// handles, since every step of the build depends only on that order.  ROOT_SPECIFIED depends on the
+	// handles themselves, so nothing is shared with that policy.
+	void findSharedStructure(const BuildOptions &options)
+	{
+		mTemplates.clear();
+		if (!options.mShareStructure || options.mLazy || mRootPolicy == ROOT_SPECIFIED)
+		{
+			return;
+		}
+		mLocalBodies.assign(mRigidBodies.size(), INVALID_INDEX);
+		std::vector< std::pair< uint64_t, uint32_t > > hashes(mComponentCount);
+		for (uint32_t i = 0; i < mComponentCount; i++)
+		{
+			uint32_t next = 0;
+			uint64_t hash = 14695981039346656037ULL ^ (mComponentStart[i + 1] - mComponentStart[i]);
+			for (uint32_t k = mComponentStart[i]; k < mComponentStart[i + 1]; k++)
+			{
+				const JointRef &j = mJoints[mComponentJoints[k]];
+				if (mLocalBodies[j.mBody0] == INVALID_INDEX)
+				{
+					mLocalBodies[j.mBody0] = next++;
+				}
+				if (mLocalBodies[j.mBody1] == INVALID_INDEX)
+				{
+					mLocalBodies[j.mBody1] = next++;
+				}
+				hash = (hash ^ mLocalBodies[j.mBody0]) * 1099511628211ULL;
+				hash = (hash ^ mLocalBodies[j.mBody1]) * 1099511628211ULL;
+			}
+			hashes[i] = std::make_pair(hash, i);
+		}
+		// Within each run of equal hashes, in definition order, a component shares the structure of the
+		// first earlier one which really matches
+		std::sort(hashes.begin(), hashes.end());
+		mTemplates.resize(mComponentCount);
+		size_t run = 0;
+		for (size_t i = 0; i < hashes.size(); i++)
+		{
+			if (hashes[i].first != hashes[run].first)
+			{
+				run = i;
+			}
+			uint32_t component = hashes[i].second;
+			mTemplates[component] = component;
+			for (size_t k = run; k < i; k++)
+			{
+				uint32_t candidate = hashes[k].second;
+				if (mTemplates[candidate] == candidate && isSameStructure(candidate, component))
+				{
+					mTemplates[component] = candidate;
+					HB_STAT(mStats.mSharedHierarchyCount++);
+					break;
+				}
+			}
+		}
+		HB_STAT(mTransientBytes += vectorBytes(hashes));
+	}
+
+	bool isSameStructure(uint32_t a, uint32_t b) const
+	{
+		uint32_t count = mComponentStart[a + 1] - mComponentStart[a];
+		bool ret = count == mComponentStart[b + 1] - mComponentStart[b];
+		for (uint32_t i = 0; ret && i < count; i++)
+		{
+			const JointRef &ja = mJoints[mComponentJoints[mComponentStart[a] + i]];
+			const JointRef &jb = mJoints[mComponentJoints[mComponentStart[b] + i]];
+			ret = mLocalBodies[ja.mBody0] == mLocalBodies[jb.mBody0] && mLocalBodies[ja.mBody1] == mLocalBodies[jb.mBody1];
+		}
+		return ret;
+	}
+
+	// Fills in the handles of a hierarchy which shares the structure of 't'.  The joints of both are in
+	// definition order, so each joint takes the node of the matching template joint, and the rigid body of
+	// that node is the same end of the joint as in the template.
+	void shareHierarchy(TreeScratch &s, Hierarchy *h, const Hierarchy *t, const uint32_t *joints, const uint32_t *templateJoints, uint32_t jointCount)
+	{
+		for (uint32_t i = 0; i < jointCount; i++)
+		{
+			const JointRef &tj = mJoints[templateJoints[i]];
+			const JointRef &j = mJoints[joints[i]];
+			uint32_t node = mJointNodes[templateJoints[i]];
+			uint32_t body = t->mRigidBodies[node] == tj.mBody1 ? j.mBody1 : j.mBody0;
+			h->mRigidBodies[node] = body;
+			h->mJoints[node] = joints[i];
+			mJointNodes[joints[i]] = node;
+			mRigidBodies[body].mHierarchy = h;
+		}
+		// The root is the other end of the joint to the first child
+		const JointRef &tj = mJoints[t->mJoints[1]];
+		const JointRef &j = mJoints[h->mJoints[1]];
+		uint32_t root = t->mRigidBodies[1] == tj.mBody1 ? j.mBody0 : j.mBody1;
+		h->mRigidBodies[0] = root;
+		h->mJoints[0] = INVALID_INDEX;
+		mRigidBodies[root].mHierarchy = h;
+		for (uint32_t k = 0; k < h->mNodeCount; k++)
+		{
+			h->mLinks[k].mHierarchy = h;
+			h->mLinks[k].mNode = k;
+			HB_STAT(s.mLoopJointCount += h->mLoopJoints[k]);
+		}
+		if (h->mDepthFirstBodies)
+		{
+			h->mBodyCount = t->mBodyCount;
+			h->mDepthFirstBodies[0] = root;
+			h->mDepthFirstJoints[0] = INVALID_INDEX;
+			for (uint32_t i = 1; i < h->mNodeCount; i++)
+			{
+				uint32_t node = mJointNodes[t->mDepthFirstJoints[i]];
+				h->mDepthFirstBodies[i] = i < h->mBodyCount ? h->mRigidBodies[node] : INVALID_INDEX;
+				h->mDepthFirstJoints[i] = h->mJoints[node];
+			}
+			for (uint32_t i = 0; i < h->mBodyCount; i++)
+			{
+				mDepthFirstIndices[h->mDepthFirstBodies[i]] = i;
+			}
+		}
+	}
+
+	// Build one hierarchy from the joints of its component, given in definition order
+	void buildHierarchy(TreeScratch &s, Hierarchy *h, const uint32_t *joints, uint32_t jointCount)
+	{
+		uint32_t root = selectRoot(s, mJoints[joints[0]].mBody0);
+		switch (mRootPolicy)
+		{
+			case ROOT_SPECIFIED:
+				root = findSpecifiedRoot(joints, jointCount, root);
+				break;
+			case ROOT_TREE_CENTER:
+				root = findTreeCenter(s, root);
+				break;
+			case ROOT_MAX_DEGREE:
+				root = findMaxDegreeBody(joints, jointCount);
+				break;
+			default:
+				break;
+		}
+		buildTree(s, root);
+		layoutTree(s, h);
+		// Every joint which reached a rigid body already in the tree is a loop joint, so skipping the loop
+		// joints always leaves a spanning tree which reaches every rigid body from the root
+		for (uint32_t k = 1; k < h->mNodeCount; k++)
+		{
+			h->mLoopJoints[k] = s.mLoopNodes[s.mOrder[k]];
+			HB_STAT(s.mLoopJointCount += h->mLoopJoints[k]);
+		}
+		if (h->mDepthFirstBodies)
+		{
+			layoutDepthFirst(s, h);
+			if (h->mAncestorTable)
+			{
+				h->buildAncestorTable();
+			}
+		}
+	}
+
+	// The tree recorded by buildTree() is already in depth first order, so the depth first layout keeps the
+	// nodes which reached a new rigid body in creation order and moves the rest to the end as loop joints.
+	void layoutDepthFirst(TreeScratch &s, Hierarchy *h)
+	{
+		uint32_t count = uint32_t(s.mParents.size());
+		s.mDepthFirst.resize(count);
+		uint32_t bodyCount = 0;
+		for (uint32_t k = 0; k < count; k++)
+		{
+			if (!s.mLoopNodes[k])
+			{
+				uint32_t i = bodyCount++;
+				s.mDepthFirst[k] = i;
+				mDepthFirstIndices[s.mRigidBodies[k]] = i;
+				h->mDepthFirstBodies[i] = s.mRigidBodies[k];
+				h->mDepthFirstParents[i] = k ? s.mDepthFirst[s.mParents[k]] : INVALID_INDEX;
+				h->mDepthFirstJoints[i] = s.mJoints[k];
+				h->mSubtreeEnds[i] = i + 1;
+			}
+		}
+		h->mBodyCount = bodyCount;
+		// Children always follow their parent, so walking backwards completes every subtree before its parent
+		for (uint32_t i = bodyCount - 1; i > 0; i--)
+		{
+			uint32_t parent = h->mDepthFirstParents[i];
+			if (h->mSubtreeEnds[i] > h->mSubtreeEnds[parent])
+			{
+				h->mSubtreeEnds[parent] = h->mSubtreeEnds[i];
+			}
+		}
+		uint32_t loop = bodyCount;
+		for (uint32_t k = 1; k < count; k++)
+		{
+			if (s.mLoopNodes[k])
+			{
+				const JointRef &j = mJoints[s.mJoints[k]];
+				h->mDepthFirstBodies[loop] = INVALID_INDEX;
+				h->mDepthFirstParents[loop] = mDepthFirstIndices[j.mBody0];
+				h->mDepthFirstJoints[loop] = s.mJoints[k];
+				h->mSubtreeEnds[loop] = mDepthFirstIndices[j.mBody1];
+				loop++;
+			}
+		}
+	}
+
+	// Keeps the root policy of a full build for the incremental updates which follow it
+	void setRootPolicy(const BuildOptions &options)
+	{
+		mRootPolicy = options.mRootPolicy;
+		mRootOrder.clear();
+		if (mRootPolicy == ROOT_SPECIFIED)
+		{
+			mRootOrder.resize(mRigidBodies.size(), INVALID_INDEX);
+			for (uint32_t i = options.mRootBodyCount; i > 0; i--)
+			{
+				uint32_t body = options.mRootBodies[i - 1];
+				if (body < mRootOrder.size())
+				{
+					mRootOrder[body] = i - 1; // the earliest listing wins
+				}
+			}
+		}
+	}
+
+	// The most preferred caller specified root in the component; 'root' if there is none
+	uint32_t findSpecifiedRoot(const uint32_t *joints, uint32_t jointCount, uint32_t root) const
+	{
+		uint32_t ret = root;
+
+		uint32_t best = INVALID_INDEX;
+		for (uint32_t i = 0; i < jointCount; i++)
+		{
+			const JointRef &j = mJoints[joints[i]];
+			uint32_t bodies[2] = { j.mBody0, j.mBody1 };
+			for (auto &b : bodies)
+			{
+				if (b < mRootOrder.size() && mRootOrder[b] < best)
+				{
+					best = mRootOrder[b];
+					ret = b;
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	// Every joint of a rigid body is in its component, so the degree kept for each body is its degree
+	// within the component
+	uint32_t findMaxDegreeBody(const uint32_t *joints, uint32_t jointCount)
+	{
+		uint32_t ret = mJoints[joints[0]].mBody0;
+
+		uint32_t best = 0;
+		for (uint32_t i = 0; i < jointCount; i++)
+		{
+			const JointRef &j = mJoints[joints[i]];
+			uint32_t bodies[2] = { j.mBody0, j.mBody1 };
+			for (auto &b : bodies)
+			{
+				if (mRigidBodies[b].mDegree > best)
+				{
+					best = mRigidBodies[b].mDegree;
+					ret = b;
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	// Builds the spanning tree from 'root' and returns the rigid body with the smallest eccentricity in it.
+	// The height below each node comes from a pass in reverse creation order (children are always created
+	// after their parent) and the height through the parent from a forward pass, so this is linear.
+	uint32_t findTreeCenter(TreeScratch &s, uint32_t root)
+	{
+		buildTree(s, root);
+		uint32_t count = uint32_t(s.mParents.size());
+		s.mHeights.assign(count, 0);
+		s.mSecondHeights.assign(count, 0);
+		s.mTallestChild.assign(count, INVALID_INDEX);
+		s.mUpHeights.assign(count, 0);
+		for (uint32_t i = count; i-- > 1;)
+		{
+			if (!s.mLoopNodes[i])
+			{
+				uint32_t parent = s.mParents[i];
+				uint32_t height = s.mHeights[i] + 1;
+				if (height > s.mHeights[parent])
+				{
+					s.mSecondHeights[parent] = s.mHeights[parent];
+					s.mHeights[parent] = height;
+					s.mTallestChild[parent] = i;
+				}
+				else if (height > s.mSecondHeights[parent])
+				{
+					s.mSecondHeights[parent] = height;
+				}
+			}
+		}
+		uint32_t center = 0;
+		uint32_t best = s.mHeights[0];
+		for (uint32_t i = 1; i < count; i++)
+		{
+			if (!s.mLoopNodes[i])
+			{
+				uint32_t parent = s.mParents[i];
+				uint32_t sibling = s.mTallestChild[parent] == i ? s.mSecondHeights[parent] : s.mHeights[parent];
+				s.mUpHeights[i] = 1 + std::max(s.mUpHeights[parent], sibling);
+				uint32_t eccentricity = std::max(s.mHeights[i], s.mUpHeights[i]);
+				if (eccentricity < best)
+				{
+					best = eccentricity;
+					center = i;
+				}
+			}
+		}
+		// Undo the traversal so the tree can be built again from the center
+		for (uint32_t i = 0; i < count; i++)
+		{
+			mVisited[s.mRigidBodies[i]] = 0;
+			if (i)
+			{
+				mJointVisited[s.mJoints[i]] = 0;
+			}
+		}
+		return s.mRigidBodies[center];
+	}
+
+	void findComponents(void)
+	{
+		uint32_t bodyCount = uint32_t(mRigidBodies.size());
+		uint32_t jointCount = uint32_t(mJoints.size());
+
+		mSets.init(bodyCount);
+		for (auto &i : mJoints)
+		{
+			if (!i.mRemoved)
+			{
+				mSets.unite(i.mBody0, i.mBody1);
+			}
+		}
+
+		// Label each set by the first joint which references it
+		IndexVector setComponent(bodyCount, INVALID_INDEX);
+		IndexVector jointComponent(jointCount, INVALID_INDEX);
+		uint32_t liveCount = 0;
+		mComponentCount = 0;
+		for (uint32_t i = 0; i < jointCount; i++)
+		{
+			if (!mJoints[i].mRemoved)
+			{
+				uint32_t set = mSets.find(mJoints[i].mBody0);
+				if (setComponent[set] == INVALID_INDEX)
+				{
+					setComponent[set] = mComponentCount++;
+				}
+				jointComponent[i] = setComponent[set];
+				liveCount++;
+			}
+		}
+
+		// Bucket the joints by component, preserving definition order within each component
+		mComponentStart.assign(mComponentCount + 1, 0);
+		for (uint32_t i = 0; i < jointCount; i++)
+		{
+			if (jointComponent[i] != INVALID_INDEX)
+			{
+				mComponentStart[jointComponent[i] + 1]++;
+			}
+		}
+		for (uint32_t i = 0; i < mComponentCount; i++)
+		{
+			mComponentStart[i + 1] += mComponentStart[i];
+		}
+		IndexVector cursor(mComponentStart.begin(), mComponentStart.end() - 1);
+		mComponentJoints.resize(liveCount);
+		for (uint32_t i = 0; i < jointCount; i++)
+		{
+			if (jointComponent[i] != INVALID_INDEX)
+			{
+				mComponentJoints[cursor[jointComponent[i]]++] = i;
+			}
+		}
+		HB_STAT(mTransientBytes = vectorBytes(setComponent) + vectorBytes(jointComponent) + vectorBytes(cursor));
+	}
+
+	// The root is found by starting at body0 of the first joint in the component and walking
+	// up through incoming joints until we reach a body with no parent, or we come back around
+	// on ourselves because of a loop.
+	uint32_t selectRoot(TreeScratch &s, uint32_t body)
+	{
+		s.mPath.clear();
+		for (;;)
+		{
+			mVisited[body] = 1;
+			s.mPath.push_back(body);
+			uint32_t incoming = mRigidBodies[body].mFirstIn;
+			if (incoming == INVALID_INDEX)
+			{
+				break;
+			}
+			uint32_t parent = mJoints[incoming].mBody0;
+			if (mVisited[parent])
+			{
+				break;
+			}
+			body = parent;
+		}
+		for (auto &i : s.mPath)
+		{
+			mVisited[i] = 0;
+		}
+		HB_STAT(s.mRootSteps += s.mPath.size());
+		return body;
+	}
+
+	// Depth first traversal from the root; every joint in the component produces exactly one node.
+	// A joint which refers back to a body already in the tree produces a leaf node for that body.
+	// Nodes are recorded in creation order along with their parent node.
+	void buildTree(TreeScratch &s, uint32_t root)
+	{
+		s.mParents.clear();
+		s.mRigidBodies.clear();
+		s.mJoints.clear();
+		s.mLoopNodes.clear();
+		s.mParents.push_back(INVALID_INDEX);
+		s.mRigidBodies.push_back(root);
+		s.mJoints.push_back(INVALID_INDEX);
+		s.mLoopNodes.push_back(0);
+		s.mStack.clear();
+		mVisited[root] = 1;
+		s.mStack.push_back(TreeFrame{ 0, root, mRigidBodies[root].mFirstOut, false });
+		while (!s.mStack.empty())
+		{
+			// Outgoing joints (where this body is body0) are visited before incoming joints,
+			// each in definition order
+			TreeFrame &f = s.mStack.back();
+			if (f.mCursor == INVALID_INDEX)
+			{
+				if (f.mIncoming)
+				{
+					s.mStack.pop_back();
+				}
+				else
+				{
+					f.mIncoming = true;
+					f.mCursor = mRigidBodies[f.mBody].mFirstIn;
+				}
+				continue;
+			}
+			uint32_t joint = f.mCursor;
+			f.mCursor = f.mIncoming ? mJoints[joint].mNextIn : mJoints[joint].mNextOut;
+			HB_STAT(s.mTraversalSteps++);
+			if (mJointVisited[joint])
+			{
+				continue;
+			}
+			mJointVisited[joint] = 1;
+			const JointRef &j = mJoints[joint];
+			uint32_t other = j.mBody0 == f.mBody ? j.mBody1 : j.mBody0;
+			uint32_t child = uint32_t(s.mParents.size());
+			s.mParents.push_back(f.mNode);
+			s.mRigidBodies.push_back(other);
+			s.mJoints.push_back(joint);
+			s.mLoopNodes.push_back(mVisited[other]);
+			if (!mVisited[other])
+			{
+				mVisited[other] = 1;
+				s.mStack.push_back(TreeFrame{ child, other, mRigidBodies[other].mFirstOut, false });
+			}
+		}
+	}
+
+	// Copies the tree recorded by buildTree() into the hierarchy's flat storage in breadth first
+	// order, so that the children of every node are contiguous.  Children keep their creation order.
+	void layoutTree(TreeScratch &s, Hierarchy *h)
+	{
+		uint32_t count = uint32_t(s.mParents.size());
+		// Bucket the nodes by parent
+		s.mChildStart.assign(count + 1, 0);
+		for (uint32_t i = 1; i < count; i++)
+		{
+			s.mChildStart[s.mParents[i] + 1]++;
+		}
+		for (uint32_t i = 0; i < count; i++)
+		{
+			s.mChildStart[i + 1] += s.mChildStart[i];
+		}
+		IndexVector cursor(s.mChildStart.begin(), s.mChildStart.end() - 1);
+		s.mChildren.resize(count);
+		for (uint32_t i = 1; i < count; i++)
+		{
+			s.mChildren[cursor[s.mParents[i]]++] = i;
+		}
+		// Breadth first; mOrder[k] is the creation order node placed at position k
+		s.mOrder.resize(count);
+		s.mOrder[0] = 0;
+		uint32_t tail = 1;
+		for (uint32_t k = 0; k < count; k++)
+		{
+			uint32_t node = s.mOrder[k];
+			h->mRigidBodies[k] = s.mRigidBodies[node];
+			h->mJoints[k] = s.mJoints[node];
+			mRigidBodies[s.mRigidBodies[node]].mHierarchy = h;
+			if (k)
+			{
+				mJointNodes[s.mJoints[node]] = k;
+			}
+			h->mChildOffsets[k] = tail;
+			for (uint32_t i = s.mChildStart[node]; i < s.mChildStart[node + 1]; i++)
+			{
+				s.mOrder[tail++] = s.mChildren[i];
+			}
+			h->mLinks[k].mHierarchy = h;
+			h->mLinks[k].mNode = k;
+		}
+		h->mChildOffsets[count] = count;
+	}
+
+	// Hierarchy storage from a full build lives in the arena, so it is freed with a single rewind;
+	// only hierarchies replaced by incremental updates are freed one at a time
+	void releaseHierarchies(void)
+	{
+		for (auto &i : mHierarchies)
+		{
+			freeHierarchy(i);
+		}
+		mHierarchies.clear();
+		mArena.rewind();
+		clearDirtyHierarchies();
+	}
+
+	virtual void release(void) override final
+	{
+		delete this;
+	}
+
+	void checkForDisconnectedRigidBodies(void)
+	{
+		mDisconnectedRigidBodies.clear();
+		for (uint32_t i = 0; i < uint32_t(mRigidBodies.size()); i++)
+		{
+			RigidBodyRef &b = mRigidBodies[i];
+			b.mHierarchy = nullptr;
+			b.mDisconnectedSlot = INVALID_INDEX;
+			if (!b.mRemoved && b.mDegree == 0)
+			{
+				addDisconnected(i);
+			}
+		}
+	}
+
+	void addDisconnected(uint32_t body)
+	{
+		mRigidBodies[body].mDisconnectedSlot = uint32_t(mDisconnectedRigidBodies.size());
+		mDisconnectedRigidBodies.push_back(body);
+	}
+
+	void removeDisconnected(uint32_t body)
+	{
+		uint32_t slot = mRigidBodies[body].mDisconnectedSlot;
+		if (slot != INVALID_INDEX)
+		{
+			uint32_t last = mDisconnectedRigidBodies.back();
+			mDisconnectedRigidBodies[slot] = last;
+			mRigidBodies[last].mDisconnectedSlot = slot;
+			mDisconnectedRigidBodies.pop_back();
+			mRigidBodies[body].mDisconnectedSlot = INVALID_INDEX;
+		}
+	}
+
+	// Applies a change made after build() to the hierarchies.  Every hierarchy affected by the change
+	// contains at least one of the seed bodies, before or after the change.  The components now
+	// reachable from the seeds are found and rebuilt, and they replace the hierarchies which
+	// previously held any of those bodies.  The cost depends only on the size of those components.
+	void updateComponents(const uint32_t *seeds, uint32_t seedCount)
+	{
+		HB_STAT(Timer timer);
+		HB_STAT(mTransientBytes = 0);
+		mVisited.resize(mRigidBodies.size(), 0);
+		mUpdateMarks.resize(mRigidBodies.size(), 0);
+		if (mRootPolicy == ROOT_SPECIFIED)
+		{
+			mRootOrder.resize(mRigidBodies.size(), INVALID_INDEX);
+		}
+		mJointVisited.resize(mJoints.size(), 0);
+		mJointNodes.resize(mJoints.size());
+		if (mDepthFirstView)
+		{
+			mDepthFirstIndices.resize(mRigidBodies.size());
+		}
+		if (mScratch.empty())
+		{
+			mScratch.resize(1);
+		}
+		mUpdateEpoch++;
+		mReplacedHierarchies.clear();
+		mNewHierarchies.clear();
+		for (uint32_t i = 0; i < seedCount; i++)
+		{
+			replaceHierarchy(mRigidBodies[seeds[i]].mHierarchy);
+		}
+		for (uint32_t i = 0; i < seedCount; i++)
+		{
+			uint32_t seed = seeds[i];
+			if (mRigidBodies[seed].mRemoved)
+			{
+				mRigidBodies[seed].mHierarchy = nullptr;
+				continue;
+			}
+			if (mUpdateMarks[seed] == mUpdateEpoch)
+			{
+				continue;
+			}
+			collectComponent(seed);
+			if (mUpdateJoints.empty())
+			{
+				// No joints left on this body
+				mRigidBodies[seed].mHierarchy = nullptr;
+				if (mRigidBodies[seed].mDisconnectedSlot == INVALID_INDEX)
+				{
+					addDisconnected(seed);
+				}
+				continue;
+			}
+			std::sort(mUpdateJoints.begin(), mUpdateJoints.end());
+			for (auto &j : mUpdateBodies)
+			{
+				replaceHierarchy(mRigidBodies[j].mHierarchy);
+				removeDisconnected(j);
+				mVisited[j] = 0;
+			}
+			for (auto &j : mUpdateJoints)
+			{
+				mJointVisited[j] = 0;
+			}
+			Hierarchy *h = createHierarchy(uint32_t(mUpdateJoints.size()) + 1);
+			buildHierarchy(mScratch[0], h, &mUpdateJoints[0], uint32_t(mUpdateJoints.size()));
+			mNewHierarchies.push_back(h);
+		}
+		// The new hierarchies take over the positions of the ones they replace, lowest first
+		std::sort(mReplacedHierarchies.begin(), mReplacedHierarchies.end());
+		mOldHierarchies.clear();
+		for (auto &i : mReplacedHierarchies)
+		{
+			mOldHierarchies.push_back(mHierarchies[i]);
+		}
+		uint32_t reused = 0;
+		for (auto &i : mNewHierarchies)
+		{
+			if (reused < mReplacedHierarchies.size())
+			{
+				setHierarchy(mReplacedHierarchies[reused++], i);
+			}
+			else
+			{
+				mHierarchies.push_back(nullptr);
+				setHierarchy(uint32_t(mHierarchies.size() - 1), i);
+			}
+		}
+		// Any positions left over are filled from the end of the list, highest first
+		for (size_t i = mReplacedHierarchies.size(); i > reused; i--)
+		{
+			uint32_t index = mReplacedHierarchies[i - 1];
+			uint32_t last = uint32_t(mHierarchies.size() - 1);
+			if (index != last)
+			{
+				setHierarchy(index, mHierarchies[last]);
+			}
+			mHierarchies.pop_back();
+			eraseDirty(last);
+		}
+		for (auto &i : mOldHierarchies)
+		{
+			freeHierarchy(i);
+		}
+#if HIERARCHY_BUILDER_STATS
+		mStats.mUpdateCount++;
+		mStats.mRebuiltHierarchyCount += uint32_t(mNewHierarchies.size());
+		mStats.mUpdateTime += timer.lap();
+		updatePeakBytes();
+#endif
+	}
+
+	// Frees a hierarchy allocated by an incremental update; the rest live in the arena
+	void freeHierarchy(Hierarchy *h)
+	{
+		if (h->mOwned)
+		{
+			HB_STAT(mOwnedAllocationCount--);
+			HB_STAT(mOwnedBytes -= h->mAllocationSize);
+			mArena.getAllocator()->deallocate(h);
+		}
+	}
+
+	// Marks the hierarchy at this position for replacement by the current update
+	void replaceHierarchy(Hierarchy *h)
+	{
+		if (h && !h->mReplaced)
+		{
+			h->mReplaced = true;
+			mReplacedHierarchies.push_back(uint32_t(h->mIndex));
+		}
+	}
+
+	void setHierarchy(uint32_t index, Hierarchy *h)
+	{
+		mHierarchies[index] = h;
+		h->mIndex = index;
+		markDirty(index);
+	}
+
+	// Gathers the bodies and joints of the component containing this body
+	void collectComponent(uint32_t body)
+	{
+		mUpdateBodies.clear();
+		mUpdateJoints.clear();
+		mUpdateMarks[body] = mUpdateEpoch;
+		mUpdateBodies.push_back(body);
+		for (size_t i = 0; i < mUpdateBodies.size(); i++)
+		{
+			const RigidBodyRef &b = mRigidBodies[mUpdateBodies[i]];
+			for (uint32_t j = b.mFirstOut; j != INVALID_INDEX; j = mJoints[j].mNextOut)
+			{
+				mUpdateJoints.push_back(j); // every joint is on exactly one outgoing list
+				visitUpdateBody(mJoints[j].mBody1);
+			}
+			for (uint32_t j = b.mFirstIn; j != INVALID_INDEX; j = mJoints[j].mNextIn)
+			{
+				visitUpdateBody(mJoints[j].mBody0);
+			}
+		}
+	}
+
+	void visitUpdateBody(uint32_t body)
+	{
+		if (mUpdateMarks[body] != mUpdateEpoch)
+		{
+			mUpdateMarks[body] = mUpdateEpoch;
+			mUpdateBodies.push_back(body);
+		}
+	}
+
+	// Allocates a hierarchy and its node storage as a single block from the allocator
+	Hierarchy *createHierarchy(uint32_t nodeCount)
+	{
+		size_t hierarchySize = alignSize(sizeof(Hierarchy));
+		size_t linkSize = alignSize(sizeof(Link) * nodeCount);
+		size_t indexSize = alignSize(sizeof(uint32_t) * nodeCount);
+		size_t offsetSize = alignSize(sizeof(uint32_t) * (nodeCount + 1));
+		size_t depthFirstSize = mDepthFirstView ? indexSize * 4 : 0;
+		size_t ancestorTableSize = mPathQueries ? alignSize(sizeof(uint32_t) * Hierarchy::getAncestorTableSize(nodeCount)) : 0;
+		size_t size = hierarchySize + linkSize + indexSize * 2 + offsetSize + depthFirstSize + ancestorTableSize + nodeCount;
+		uint8_t *mem = static_cast<uint8_t *>(mArena.getAllocator()->allocate(size));
+		Hierarchy *h = new (mem) Hierarchy(0);
+		mem += hierarchySize;
+		h->mOwned			= true;
+		HB_STAT(h->mAllocationSize = size);
+		HB_STAT(mOwnedAllocationCount++);
+		HB_STAT(mOwnedBytes += size);
+		h->mNodeCount		= nodeCount;
+		h->mLinks			= reinterpret_cast<Link *>(mem);
+		mem += linkSize;
+		h->mRigidBodies		= reinterpret_cast<uint32_t *>(mem);
+		mem += indexSize;
+		h->mJoints			= reinterpret_cast<uint32_t *>(mem);
+		mem += indexSize;
+		h->mChildOffsets	= reinterpret_cast<uint32_t *>(mem);
+		mem += offsetSize;
+		if (mDepthFirstView)
+		{
+			h->mDepthFirstBodies	= reinterpret_cast<uint32_t *>(mem);
+			h->mDepthFirstParents	= h->mDepthFirstBodies + nodeCount;
+			h->mDepthFirstJoints	= h->mDepthFirstParents + nodeCount;
+			h->mSubtreeEnds			= h->mDepthFirstJoints + nodeCount;
+			mem += depthFirstSize;
+		}
+		if (mPathQueries)
+		{
+			h->mAncestorTable		= reinterpret_cast<uint32_t *>(mem);
+			mem += ancestorTableSize;
+		}
+		h->mLoopJoints		= mem;
+		memset(h->mLoopJoints, 0, nodeCount);
+		for (uint32_t i = 0; i < nodeCount; i++)
+		{
+			new (&h->mLinks[i]) Link;
+		}
+		h->mBodyNames		= &mBodyNames;
+		h->mJointNames		= &mJointNames;
+		return h;
+	}
+
+	static size_t alignSize(size_t size)
+	{
+		return (size + 15) & ~size_t(15);
+	}
+
+	void markDirty(uint32_t index)
+	{
+		if (mDirtyFlags.size() <= index)
+		{
+			mDirtyFlags.resize(index + 1, 0);
+		}
+		if (!mDirtyFlags[index])
+		{
+			mDirtyFlags[index] = 1;
+			mDirtyHierarchies.push_back(index);
+		}
+	}
+
+	// Forget a position which no longer exists
+	void eraseDirty(uint32_t index)
+	{
+		if (index < mDirtyFlags.size() && mDirtyFlags[index])
+		{
+			mDirtyFlags[index] = 0;
+			for (size_t i = 0; i < mDirtyHierarchies.size(); i++)
+			{
+				if (mDirtyHierarchies[i] == index)
+				{
+					mDirtyHierarchies[i] = mDirtyHierarchies.back();
+					mDirtyHierarchies.pop_back();
+					break;
+				}
+			}
+		}
+	}
+
+	virtual uint32_t getDirtyHierarchyCount(void) const override final
+	{
+		return uint32_t(mDirtyHierarchies.size());
+	}
+
+	virtual uint32_t getDirtyHierarchy(uint32_t index) const override final
+	{
+		uint32_t ret = INVALID_INDEX;
+
+		if (index < mDirtyHierarchies.size())
+		{
+			ret = mDirtyHierarchies[index];
+		}
+
+		return ret;
+	}
+
+	virtual void clearDirtyHierarchies(void) override final
+	{
+		for (auto &i : mDirtyHierarchies)
+		{
+			mDirtyFlags[i] = 0;
+		}
+		mDirtyHierarchies.clear();
+	}
+
+	// Returns the number of rigid bodies which were not connected by any joints
+	virtual uint32_t getDisconnectedRigidBodyCount(void) override final
+	{
+		return uint32_t(mDisconnectedRigidBodies.size());
+	}
+
+	// Returns the name of this disconnected rigid body; null of this index is out of range
+	virtual const char * getDisconnectedRigidBody(uint32_t index) override final
+	{
+		const char *ret = nullptr;
+
+		if (index < mDisconnectedRigidBodies.size())
+		{
+			ret = mBodyNames.getName(mDisconnectedRigidBodies[index]);
+		}
+
+		return ret;
+	}
+
+	// Returns the index of this disconnected rigid body; INVALID_HANDLE if this index is out of range
+	virtual uint32_t getDisconnectedRigidBodyIndex(uint32_t index) override final
+	{
+		uint32_t ret = INVALID_INDEX;
+
+		if (index < mDisconnectedRigidBodies.size())
+		{
+			ret = mDisconnectedRigidBodies[index];
+		}
+
+		return ret;
+	}
+
+	// Walks the HierarchyLink interface with an explicit stack, in the same order as printChain
+	void showHierarchy(const HIERARCHY_BUILDER::HierarchyLink *root)
+	{
+		std::vector< std::pair< const HIERARCHY_BUILDER::HierarchyLink *, uint32_t > > stack;
+		stack.push_back(std::make_pair(root, 0u));
+		while (!stack.empty())
+		{
+			const HIERARCHY_BUILDER::HierarchyLink *link = stack.back().first;
+			uint32_t depth = stack.back().second;
+			stack.pop_back();
+			uint32_t count = link->getChildCount();
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const char *body0;
+				const char *body1;
+				bool isLoopJoint;
+				const char *j = link->getJoint(i, body0, body1, isLoopJoint);
+				for (uint32_t k = 0; k < depth; k++)
+				{
+					printf("    ");
+				}
+				printf("%s : %s->%s : loop(%s)\r\n", j, body0, body1, isLoopJoint ? "true" : "false");
+			}
+			for (uint32_t i = count; i > 0; i--)
+			{
+				stack.push_back(std::make_pair(link->getChild(i - 1), depth + 1));
+			}
+		}
+	}
+
+	// Write the built hierarchies and the names of every rigid body and joint to a snapshot file
+	virtual bool save(const char *fileName) override final
+	{
+		bool ret = false;
+
+		if (mBuilt)
+		{
+			// The layout is computed by a pass which writes nothing, then the file is written in the same order.
+			// String table offsets are 32 bit, so the names must fit in 4GB.
+			SnapshotHeader header;
+			writeSnapshot(nullptr, header);
+			if (header.mStringsSize != INVALID_INDEX)
+			{
+				FILE *fph = fopen(fileName, "wb");
+				if (fph)
+				{
+					fwrite(&header, sizeof(header), 1, fph);
+					writeSnapshot(fph, header);
+					ret = ferror(fph) == 0;
+					if (fclose(fph) != 0)
+					{
+						ret = false;
+					}
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	// Writes every section after the header.  With no file it only fills in the header.
+	void writeSnapshot(FILE *fph, SnapshotHeader &header)
+	{
+		materializeAll();
+		SnapshotWriter w(fph);
+		w.mOffset = sizeof(SnapshotHeader);
+
+		uint32_t nodeCount = 0;
+		for (auto &i : mHierarchies)
+		{
+			nodeCount += i->mNodeCount;
+		}
+
+		// String table
+		header.mStrings = w.mOffset;
+		w.write("", 1);
+		for (uint32_t i = 0; i < mBodyNames.size(); i++)
+		{
+			if (isLiveRigidBody(i) && mBodyNames.getNameLength(i))
+			{
+				w.write(mBodyNames.getScratchName(i), mBodyNames.getNameLength(i) + 1);
+			}
+		}
+		for (uint32_t i = 0; i < mJointNames.size(); i++)
+		{
+			if (!mJoints[i].mRemoved && mJointNames.getNameLength(i))
+			{
+				w.write(mJointNames.getScratchName(i), mJointNames.getNameLength(i) + 1);
+			}
+		}
+		uint64_t stringsSize = w.mOffset - header.mStrings;
+		header.mStringsSize = stringsSize < INVALID_INDEX ? uint32_t(stringsSize) : INVALID_INDEX;
+		w.align();
+
+		// Name offsets follow the same order the strings were written in
+		uint32_t nameOffset = 1;
+		header.mBodyNames = w.mOffset;
+		for (uint32_t i = 0; i < mBodyNames.size(); i++)
+		{
+			uint32_t offset = SNAPSHOT_REMOVED;
+			if (isLiveRigidBody(i))
+			{
+				offset = 0;
+				if (mBodyNames.getNameLength(i))
+				{
+					offset = nameOffset;
+					nameOffset += uint32_t(mBodyNames.getNameLength(i) + 1);
+				}
+			}
+			w.write(&offset, sizeof(offset));
+		}
+		header.mJoints = w.mOffset;
+		for (uint32_t i = 0; i < mJointNames.size(); i++)
+		{
+			SnapshotJoint j;
+			j.mName = SNAPSHOT_REMOVED;
+			j.mBody0 = INVALID_INDEX;
+			j.mBody1 = INVALID_INDEX;
+			if (!mJoints[i].mRemoved)
+			{
+				j.mName = 0;
+				j.mBody0 = mJoints[i].mBody0;
+				j.mBody1 = mJoints[i].mBody1;
+				if (mJointNames.getNameLength(i))
+				{
+					j.mName = nameOffset;
+					nameOffset += uint32_t(mJointNames.getNameLength(i) + 1);
+				}
+			}
+			w.write(&j, sizeof(j));
+		}
+
+		// Hierarchies and their nodes
+		header.mHierarchies = w.mOffset;
+		uint32_t firstNode = 0;
+		for (auto &i : mHierarchies)
+		{
+			SnapshotHierarchy sh;
+			sh.mFirstNode = firstNode;
+			sh.mNodeCount = i->mNodeCount;
+			w.write(&sh, sizeof(sh));
+			firstNode += i->mNodeCount;
+		}
+		header.mNodeRigidBodies = w.mOffset;
+		for (auto &i : mHierarchies)
+		{
+			w.write(i->mRigidBodies, sizeof(uint32_t) * i->mNodeCount);
+		}
+		header.mNodeJoints = w.mOffset;
+		for (auto &i : mHierarchies)
+		{
+			w.write(i->mJoints, sizeof(uint32_t) * i->mNodeCount);
+		}
+		header.mChildOffsets = w.mOffset;
+		for (auto &i : mHierarchies)
+		{
+			w.write(i->mChildOffsets, sizeof(uint32_t) * (i->mNodeCount + 1));
+		}
+		header.mLoopJoints = w.mOffset;
+		for (auto &i : mHierarchies)
+		{
+			w.write(i->mLoopJoints, i->mNodeCount);
+		}
+		w.align();
+		header.mDisconnected = w.mOffset;
+		if (!mDisconnectedRigidBodies.empty())
+		{
+			w.write(&mDisconnectedRigidBodies[0], sizeof(uint32_t) * mDisconnectedRigidBodies.size());
+		}
+
+		memcpy(header.mMagic, gSnapshotMagic, sizeof(header.mMagic));
+		header.mVersion = SNAPSHOT_VERSION;
+		header.mByteOrder = SNAPSHOT_BYTE_ORDER;
+		header.mFileSize = w.mOffset;
+		header.mRigidBodyCount = mBodyNames.size();
+		header.mJointCount = mJointNames.size();
+		header.mHierarchyCount = uint32_t(mHierarchies.size());
+		header.mDisconnectedCount = uint32_t(mDisconnectedRigidBodies.size());
+		header.mNodeCount = nodeCount;
+	}
+
+	virtual bool getBuildStats(BuildStats &stats) const override final
+	{
+		bool ret = false;
+
+#if HIERARCHY_BUILDER_STATS
+		{
+			// Hierarchies of a lazy build may be materialized, adding to the statistics, on other threads
+			std::lock_guard< std::mutex > lock(mLazyMutex);
+			stats = mStats;
+			stats.mLazyHierarchyCount = mLazyHierarchyCount;
+		}
+		stats.mHierarchyCount = uint32_t(mHierarchies.size());
+		stats.mNodeCount = 0;
+		for (auto &i : mHierarchies)
+		{
+			stats.mNodeCount += i->mNodeCount;
+		}
+		stats.mDisconnectedCount = uint32_t(mDisconnectedRigidBodies.size());
+		stats.mArenaBlockCount = mArena.getBlockCount();
+		stats.mArenaReservedBytes = mArena.getReservedBytes();
+		stats.mArenaUsedBytes = mArena.getUsedBytes();
+		stats.mOwnedAllocationCount = mOwnedAllocationCount;
+		stats.mOwnedBytes = mOwnedBytes;
+		stats.mRetainedBytes = getRetainedBytes();
+		stats.mNameBytes = mBodyNames.getMemoryUsage() + mJointNames.getMemoryUsage();
+		stats.mPeakBytes = std::max(mPeakBytes, uint64_t(stats.mRetainedBytes));
+		ret = true;
+#endif
+
+		return ret;
+	}
+
+#if HIERARCHY_BUILDER_STATS
+	// Bytes currently held by the builder, counting the capacity of every container
+	size_t getRetainedBytes(void) const
+	{
+		size_t ret = sizeof(*this);
+		ret += mBodyNames.getMemoryUsage() + mJointNames.getMemoryUsage();
+		ret += vectorBytes(mRigidBodies) + vectorBytes(mJoints) + vectorBytes(mHierarchies) + vectorBytes(mDisconnectedRigidBodies);
+		ret += mArena.getReservedBytes() + mOwnedBytes;
+		ret += vectorBytes(mSets.mParent) + vectorBytes(mSets.mRank) + vectorBytes(mComponentStart) + vectorBytes(mComponentJoints);
+		ret += vectorBytes(mVisited) + vectorBytes(mJointVisited) + vectorBytes(mJointNodes);
+		ret += vectorBytes(mTaskStart) + vectorBytes(mRootOrder) + vectorBytes(mScratch);
+		ret += vectorBytes(mDepthFirstIndices) + vectorBytes(mTemplates) + vectorBytes(mLocalBodies) + vectorBytes(mResultData);
+		for (auto &i : mScratch)
+		{
+			ret += vectorBytes(i.mPath) + vectorBytes(i.mStack) + vectorBytes(i.mParents) + vectorBytes(i.mRigidBodies);
+			ret += vectorBytes(i.mJoints) + vectorBytes(i.mChildStart) + vectorBytes(i.mChildren) + vectorBytes(i.mOrder);
+			ret += vectorBytes(i.mLoopNodes) + vectorBytes(i.mHeights) + vectorBytes(i.mSecondHeights) + vectorBytes(i.mTallestChild) + vectorBytes(i.mUpHeights);
+			ret += vectorBytes(i.mDepthFirst);
+		}
+		ret += vectorBytes(mSeeds) + vectorBytes(mUpdateMarks) + vectorBytes(mUpdateBodies) + vectorBytes(mUpdateJoints);
+		ret += vectorBytes(mReplacedHierarchies) + vectorBytes(mNewHierarchies) + vectorBytes(mOldHierarchies);
+		ret += vectorBytes(mDirtyHierarchies) + vectorBytes(mDirtyFlags);
+		return ret;
+	}
+
+	void updatePeakBytes(void)
+	{
+		uint64_t bytes = getRetainedBytes() + mTransientBytes;
+		if (bytes > mPeakBytes)
+		{
+			mPeakBytes = bytes;
+		}
+	}
+#endif
+
+	// Debug printf the results
+	// Also works as an example of how to query the results
+	virtual void debugPrint(void) final override
+	{
+		uint32_t count = getDisconnectedRigidBodyCount();
+		printf("DisconnectedRigidBodyCount: %d\r\n", count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			printf("    RigidBody[%d]=%s\r\n", i, getDisconnectedRigidBody(i));
+		}
+		uint32_t hcount = getHierarchyCount();
+		printf("Found %d hierarchies\r\n", hcount);
+		for (uint32_t i = 0; i < hcount; i++)
+		{
+			printf("========================================================\r\n");
+			printf("Hierarchy[%d]\r\n", i);
+			printf("========================================================\r\n");
+			const HIERARCHY_BUILDER::HierarchyLink *link = getHierarchyRoot(i);
+			showHierarchy(link);
+			printf("========================================================\r\n");
+			printf("\r\n");
+		}
+	}
+
+	// returns the number of hierarchies found
+	virtual uint32_t getHierarchyCount(void) const override final
+	{
+		return uint32_t(mHierarchies.size());
+	}
+
+	// Return the root link of this hierarchy
+	virtual const HierarchyLink * getHierarchyRoot(uint32_t index) const override final
+	{
+		const HierarchyLink *ret = nullptr;
+
+		if (index < mHierarchies.size())
+		{
+			materialize(mHierarchies[index]);
+			ret = static_cast<const HierarchyLink *>(mHierarchies[index]->mLinks);
+		}
+
+		return ret;
+	}
+
+	// Return the flat view of this hierarchy
+	virtual bool getHierarchyView(uint32_t index, HierarchyView &view) const override final
+	{
+		bool ret = false;
+
+		if (index < mHierarchies.size())
+		{
+			materialize(mHierarchies[index]);
+			mHierarchies[index]->getView(view);
+			ret = true;
+		}
+
+		return ret;
+	}
+
+	// Return the depth first layout of this hierarchy
+	virtual bool getDepthFirstView(uint32_t index, DepthFirstView &view) const override final
+	{
+		bool ret = false;
+
+		if (index < mHierarchies.size() && mHierarchies[index]->mDepthFirstBodies)
+		{
+			materialize(mHierarchies[index]);
+			mHierarchies[index]->getDepthFirstView(view);
+			ret = true;
+		}
+
+		return ret;
+	}
+
+	// A body lies below another exactly when its depth first index falls inside the other's subtree range
+	virtual bool isAncestor(uint32_t ancestor, uint32_t body) const override final
+	{
+		bool ret = false;
+
+		uint32_t ancestorIndex = 0;
+		uint32_t bodyIndex = 0;
+		const Hierarchy *h = findDepthFirstIndex(ancestor, ancestorIndex);
+		if (h && h == findDepthFirstIndex(body, bodyIndex))
+		{
+			ret = ancestorIndex < bodyIndex && bodyIndex < h->mSubtreeEnds[ancestorIndex];
+		}
+
+		return ret;
+	}
+
+	virtual uint32_t getLowestCommonAncestor(uint32_t body0, uint32_t body1) const override final
+	{
+		uint32_t ret = INVALID_HANDLE;
+
+		uint32_t index0 = 0;
+		uint32_t index1 = 0;
+		const Hierarchy *h = findDepthFirstIndex(body0, index0);
+		if (h && h->mAncestorTable && h == findDepthFirstIndex(body1, index1))
+		{
+			ret = h->mDepthFirstBodies[h->findCommonAncestor(index0, index1)];
+		}
+
+		return ret;
+	}
+
+	// Both bodies climb to their common ancestor.  The joints above 'body0' are written on the way up and
+	// those above 'body1' are written backwards from the end of the path, so no step is taken twice.
+	virtual uint32_t getJointPath(uint32_t body0, uint32_t body1, uint32_t *joints, uint32_t maxJoints) const override final
+	{
+		uint32_t ret = INVALID_HANDLE;
+
+		uint32_t index0 = 0;
+		uint32_t index1 = 0;
+		const Hierarchy *h = findDepthFirstIndex(body0, index0);
+		if (h && h->mAncestorTable && h == findDepthFirstIndex(body1, index1))
+		{
+			uint32_t common = h->findCommonAncestor(index0, index1);
+			uint32_t upCount = 0;
+			for (uint32_t i = index0; i != common; i = h->mDepthFirstParents[i])
+			{
+				if (upCount < maxJoints)
+				{
+					joints[upCount] = h->mDepthFirstJoints[i];
+				}
+				upCount++;
+			}
+			uint32_t downCount = 0;
+			for (uint32_t i = index1; i != common; i = h->mDepthFirstParents[i])
+			{
+				downCount++;
+			}
+			ret = upCount + downCount;
+			uint32_t slot = ret;
+			for (uint32_t i = index1; i != common; i = h->mDepthFirstParents[i])
+			{
+				slot--;
+				if (slot < maxJoints)
+				{
+					joints[slot] = h->mDepthFirstJoints[i];
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	// Return the number of rigid bodies in the system
+	virtual uint32_t getRigidBodyCount(void) override final
+	{
+		return mBodyNames.size();
+	}
+
+	// Return the name of a rigid body input
+	virtual const char *getRigidBody(uint32_t index) override final
+	{
+		const char *ret = nullptr;
+		if (isLiveRigidBody(index))
+		{
+			ret = mBodyNames.getName(index);
+		}
+		return ret;
+	}
+
+	// Return the number of joints in the system
+	virtual uint32_t getJointCount(void) override final
+	{
+		return uint32_t(mJoints.size());
+	}
+
+	// Return the name of a joint input and the names of the bodies it connects
+	virtual const char *getJoint(uint32_t index, const char *&body0, const char *&body1) override final
+	{
+		const char *ret = nullptr;
+
+		body0 = nullptr;
+		body1 = nullptr;
+		if (index < mJoints.size() && !mJoints[index].mRemoved)
+		{
+			const JointRef &j = mJoints[index];
+			ret = mJointNames.getName(index);
+			body0 = mBodyNames.getName(j.mBody0);
+			body1 = mBodyNames.getName(j.mBody1);
+		}
+
+		return ret;
+	}
+
+	// Return the indices of the bodies a joint input connects
+	virtual bool getJointBodies(uint32_t index, uint32_t &body0, uint32_t &body1) override final
+	{
+		bool ret = false;
+
+		body0 = INVALID_INDEX;
+		body1 = INVALID_INDEX;
+		if (index < mJoints.size() && !mJoints[index].mRemoved)
+		{
+			const JointRef &j = mJoints[index];
+			body0 = j.mBody0;
+			body1 = j.mBody1;
+			ret = true;
+		}
+
+		return ret;
+	}
+
+	virtual uint32_t getBodyDegree(uint32_t body) override final
+	{
+		return body < mRigidBodies.size() ? mRigidBodies[body].mDegree : 0;
+	}
+
+	// Both joint lists are in definition order, so they are merged.  A joint from the body to itself is on
+	// both lists and is only taken from the outgoing one.
+	virtual uint32_t getBodyJoints(uint32_t body, uint32_t *joints, uint32_t maxJoints) override final
+	{
+		uint32_t ret = 0;
+
+		if (body < mRigidBodies.size())
+		{
+			const RigidBodyRef &b = mRigidBodies[body];
+			uint32_t out = b.mFirstOut;
+			uint32_t in = nextIncoming(b.mFirstIn, body);
+			while (out != INVALID_INDEX || in != INVALID_INDEX)
+			{
+				uint32_t joint;
+				if (in == INVALID_INDEX || (out != INVALID_INDEX && out < in))
+				{
+					joint = out;
+					out = mJoints[out].mNextOut;
+				}
+				else
+				{
+					joint = in;
+					in = nextIncoming(mJoints[in].mNextIn, body);
+				}
+				if (ret < maxJoints)
+				{
+					joints[ret] = joint;
+				}
+				ret++;
+			}
+		}
+
+		return ret;
+	}
+
+	// The first joint on the incoming list from 'joint' on which 'body' is not also body0
+	uint32_t nextIncoming(uint32_t joint, uint32_t body) const
+	{
+		while (joint != INVALID_INDEX && mJoints[joint].mBody0 == body)
+		{
+			joint = mJoints[joint].mNextIn;
+		}
+		return joint;
+	}
+
+
+private:
+	NameTable			mBodyNames;			// Raw collection of source rigid bodies that may, or may not, be connected by joints; the id is the rigid body index
+	NameTable			mJointNames;		// Names of the source joints; the id is the joint index
+	RigidBodyRefVector	mRigidBodies;		// Joint lists and build state of each rigid body
+	JointRefVector		mJoints;			// Raw collection of source joints
+	bool				mBuilt{ false };	// Once built, changes update the affected hierarchies immediately
+	HierarchyVector		mHierarchies;		// number of unique hierarchies found
+	IndexVector			mDisconnectedRigidBodies;
+	Arena				mArena;				// Hierarchies and their flat node storage
+	uint32_t			mFlags;				// HierarchyBuilderFlags given to create
+	enum
+	{
+		TASKS_PER_THREAD = 4	// Build tasks per thread for a parallel build, to balance uneven components
+	};
+	// Scratch state used by build()
+	DisjointSet			mSets;
+	uint32_t			mComponentCount{ 0 };
+	IndexVector			mComponentStart;	// Offsets into mComponentJoints for each component
+	IndexVector			mComponentJoints;	// Joint indices bucketed by component, in definition order; kept for a lazy build
+	mutable std::mutex	mLazyMutex;			// Held while a hierarchy of a lazy build is built
+	ByteVector			mVisited;			// Rigid bodies already placed in the tree
+	ByteVector			mJointVisited;		// Joints already placed in the tree
+	IndexVector			mJointNodes;		// Node of each joint within its hierarchy
+	IndexVector			mTaskStart;			// First component of each build task
+	RootPolicy			mRootPolicy{ ROOT_FIRST_JOINT };
+	IndexVector			mRootOrder;			// Preference of each rigid body as a root for ROOT_SPECIFIED; INVALID_INDEX if none
+	bool				mDepthFirstView{ false };
+	bool				mPathQueries{ false };	// Build the ancestor table of each hierarchy along with the depth first layout
+	IndexVector			mTemplates;			// Component whose structure each component shares, itself if none; empty unless sharing
+	IndexVector			mLocalBodies;		// Order in which each rigid body first appears in its component, when sharing
+	InputHash			mInputHash;			// Every rigid body and joint added or removed, in order
+	ByteVector			mResultData;		// The result written for the cache
+	IndexVector			mDepthFirstIndices;	// Depth first index of each rigid body within its hierarchy, if the depth first layout is built
+	TreeScratchVector	mScratch;			// One per build task
+	// State used by incremental updates
+	IndexVector			mSeeds;
+	IndexVector			mUpdateMarks;		// Rigid bodies already collected by this update
+	uint32_t			mUpdateEpoch{ 0 };
+	IndexVector			mUpdateBodies;
+	IndexVector			mUpdateJoints;
+	IndexVector			mReplacedHierarchies;
+	HierarchyVector		mNewHierarchies;
+	HierarchyVector		mOldHierarchies;
+	IndexVector			mDirtyHierarchies;	// Positions of hierarchies changed since the last clearDirtyHierarchies
+	ByteVector			mDirtyFlags;
+#if HIERARCHY_BUILDER_STATS
+	BuildStats			mStats;				// Also updated by lazy builds, under mLazyMutex
+	uint32_t			mLazyHierarchyCount{ 0 };	// Hierarchies of a lazy build built so far, under mLazyMutex
+	uint32_t			mOwnedAllocationCount{ 0 };
+	size_t				mOwnedBytes{ 0 };
+	size_t				mTransientBytes{ 0 };	// Temporaries freed before the end of the last build
+	uint64_t			mPeakBytes{ 0 };
+#endif
+};
+
+HierarchyBuilder *HierarchyBuilder::create(HierarchyAllocator *allocator, uint32_t flags)
+{
+	auto ret = new HierarchyBuilderImpl(allocator ? allocator : &gDefaultAllocator, flags);
+	return static_cast<HierarchyBuilder *>(ret);
+}
+
+// The results of the scenes built by one batch task, which the views of those scenes point into
+class BatchChunk
+{
+public:
+	HierarchyBuilder	*mBuilder{ nullptr };	// Reused for every scene of the task and every batch build
+	IndexVector			mNodeStart;				// First node of each hierarchy; one more entry than there are hierarchies
+	IndexVector			mRigidBodies;
+	IndexVector			mJoints;
+	IndexVector			mChildOffsets;			// Node count+1 entries for each hierarchy, so hierarchy 'h' starts at mNodeStart[h]+h
+	ByteVector			mLoopJoints;
+	IndexVector			mDisconnected;
+};
+
+typedef std::vector< BatchChunk > BatchChunkVector;
+
+class HierarchyBatchImpl : public HierarchyBatch
+{
+public:
+	HierarchyBatchImpl(HierarchyAllocator *allocator) : mAllocator(allocator)
+	{
+	}
+
+	virtual ~HierarchyBatchImpl(void)
+	{
+		freeResults();
+		for (auto &i : mChunks)
+		{
+			i.mBuilder->release();
+		}
+	}
+
+	virtual uint32_t build(const BatchScenes &scenes, const BuildOptions &options) override final
+	{
+		freeResults();
+		mSceneCount = scenes.mSceneCount;
+		mScenes = &scenes;
+		mSceneOptions = options;
+		mSceneOptions.mThreadCount = 1;
+		mSceneOptions.mTaskScheduler = nullptr;
+		mSceneOptions.mDepthFirstView = false;
+		mSceneOptions.mPathQueries = false;
+		// The caches are not thread safe and every scene's result is read back right away
+		mSceneOptions.mCache = nullptr;
+		mSceneOptions.mLazy = false;
+		mSceneChunks.resize(mSceneCount);
+		mHierarchyStart.resize(mSceneCount);
+		mHierarchyCounts.resize(mSceneCount);
+		mDisconnectedStart.resize(mSceneCount);
+		mDisconnectedCounts.resize(mSceneCount);
+		// Scenes are split into contiguous ranges with roughly the same number of joints, so the chunks
+		// can be packed in scene order
+		uint32_t threadCount = options.mThreadCount ? options.mThreadCount : std::thread::hardware_concurrency();
+		uint32_t taskCount = (threadCount > 1 || options.mTaskScheduler) ? threadCount * TASKS_PER_THREAD : 1;
+		if (taskCount > mSceneCount)
+		{
+			taskCount = mSceneCount ? mSceneCount : 1;
+		}
+		const uint32_t *offsets = scenes.mJointOffsets;
+		uint64_t jointCount = mSceneCount ? offsets[mSceneCount] - offsets[0] : 0;
+		mTaskStart.clear();
+		mTaskStart.push_back(0);
+		for (uint32_t i = 1; i < taskCount; i++)
+		{
+			uint64_t target = offsets[0] + jointCount * i / taskCount;
+			uint32_t scene = uint32_t(std::lower_bound(offsets, offsets + mSceneCount, target) - offsets);
+			if (scene > mTaskStart.back())
+			{
+				mTaskStart.push_back(scene);
+			}
+		}
+		mTaskStart.push_back(mSceneCount);
+		uint32_t chunkCount = uint32_t(mTaskStart.size() - 1);
+		while (mChunks.size() < chunkCount)
+		{
+			mChunks.push_back(BatchChunk());
+			mChunks.back().mBuilder = HierarchyBuilder::create(mAllocator);
+		}
+		if (chunkCount == 1)
+		{
+			buildTask(this, 0);
+		}
+		else if (options.mTaskScheduler)
+		{
+			options.mTaskScheduler->parallelFor(chunkCount, buildTask, this);
+		}
+		else
+		{
+			ThreadScheduler scheduler(threadCount);
+			scheduler.parallelFor(chunkCount, buildTask, this);
+		}
+		for (uint32_t i = 0; i < mSceneCount; i++)
+		{
+			mHierarchyTotal += mHierarchyCounts[i];
+		}
+		mScenes = nullptr;
+
+		return mHierarchyTotal;
+	}
+
+	// Builds the scenes of one task and copies their results straight into the task's chunk, where they stay
+	static void buildTask(void *userData, uint32_t task)
+	{
+		HierarchyBatchImpl *batch = static_cast<HierarchyBatchImpl *>(userData);
+		const BatchScenes &scenes = *batch->mScenes;
+		BatchChunk &c = batch->mChunks[task];
+		HierarchyBuilder *hb = c.mBuilder;
+		c.mNodeStart.clear();
+		c.mNodeStart.push_back(0);
+		c.mRigidBodies.clear();
+		c.mJoints.clear();
+		c.mChildOffsets.clear();
+		c.mLoopJoints.clear();
+		c.mDisconnected.clear();
+		for (uint32_t s = batch->mTaskStart[task]; s < batch->mTaskStart[task + 1]; s++)
+		{
+			uint32_t first = scenes.mJointOffsets[s];
+			uint32_t jointCount = scenes.mJointOffsets[s + 1] - first;
+			hb->reset();
+			hb->reserve(scenes.mBodyCounts[s], jointCount);
+			for (uint32_t i = 0; i < scenes.mBodyCounts[s]; i++)
+			{
+				hb->addRigidBody();
+			}
+			hb->addJoints(&scenes.mJointBody0[first], &scenes.mJointBody1[first], jointCount);
+			uint32_t hcount = hb->build(batch->mSceneOptions);
+			batch->mSceneChunks[s] = task;
+			batch->mHierarchyStart[s] = uint32_t(c.mNodeStart.size() - 1);
+			batch->mHierarchyCounts[s] = hcount;
+			for (uint32_t i = 0; i < hcount; i++)
+			{
+				HierarchyView view;
+				hb->getHierarchyView(i, view);
+				c.mRigidBodies.insert(c.mRigidBodies.end(), view.mRigidBodies, view.mRigidBodies + view.mNodeCount);
+				c.mJoints.insert(c.mJoints.end(), view.mJoints, view.mJoints + view.mNodeCount);
+				c.mChildOffsets.insert(c.mChildOffsets.end(), view.mChildOffsets, view.mChildOffsets + view.mNodeCount + 1);
+				c.mLoopJoints.insert(c.mLoopJoints.end(), view.mLoopJoints, view.mLoopJoints + view.mNodeCount);
+				c.mNodeStart.push_back(uint32_t(c.mRigidBodies.size()));
+			}
+			uint32_t dcount = hb->getDisconnectedRigidBodyCount();
+			batch->mDisconnectedStart[s] = uint32_t(c.mDisconnected.size());
+			batch->mDisconnectedCounts[s] = dcount;
+			for (uint32_t i = 0; i < dcount; i++)
+			{
+				c.mDisconnected.push_back(hb->getDisconnectedRigidBodyIndex(i));
+			}
+		}
+	}
+
+	void freeResults(void)
+	{
+		mSceneCount = 0;
+		mHierarchyTotal = 0;
+	}
+
+	virtual uint32_t getSceneCount(void) const override final
+	{
+		return mSceneCount;
+	}
+
+	virtual uint32_t getHierarchyCount(uint32_t scene) const override final
+	{
+		uint32_t ret = 0;
+
+		if (scene < mSceneCount)
+		{
+			ret = mHierarchyCounts[scene];
+		}
+
+		return ret;
+	}
+
+	virtual bool getHierarchyView(uint32_t scene, uint32_t index, HierarchyView &view) const override final
+	{
+		bool ret = false;
+
+		if (index < getHierarchyCount(scene))
+		{
+			const BatchChunk &c = mChunks[mSceneChunks[scene]];
+			uint32_t h = mHierarchyStart[scene] + index;
+			uint32_t first = c.mNodeStart[h];
+			view.mNodeCount		= c.mNodeStart[h + 1] - first;
+			view.mRigidBodies	= &c.mRigidBodies[first];
+			view.mJoints		= &c.mJoints[first];
+			view.mLoopJoints	= &c.mLoopJoints[first];
+			view.mChildOffsets	= &c.mChildOffsets[first + h];
+			ret = true;
+		}
+
+		return ret;
+	}
+
+	virtual uint32_t getDisconnectedRigidBodyCount(uint32_t scene) const override final
+	{
+		uint32_t ret = 0;
+
+		if (scene < mSceneCount)
+		{
+			ret = mDisconnectedCounts[scene];
+		}
+
+		return ret;
+	}
+
+	virtual uint32_t getDisconnectedRigidBodyIndex(uint32_t scene, uint32_t index) const override final
+	{
+		uint32_t ret = INVALID_INDEX;
+
+		if (index < getDisconnectedRigidBodyCount(scene))
+		{
+			ret = mChunks[mSceneChunks[scene]].mDisconnected[mDisconnectedStart[scene] + index];
+		}
+
+		return ret;
+	}
+
+	virtual void release(void) override final
+	{
+		delete this;
+	}
+
+private:
+	HierarchyAllocator	*mAllocator;
+	enum
+	{
+		TASKS_PER_THREAD = 4	// Build tasks per thread, to balance uneven scenes
+	};
+	// State used while building
+	const BatchScenes	*mScenes{ nullptr };
+	BuildOptions		mSceneOptions;		// The options each scene is built with
+	IndexVector			mTaskStart;			// First scene of each build task
+	// The results, which stay in the chunk of the task which built them
+	BatchChunkVector	mChunks;				// One per build task
+	uint32_t			mSceneCount{ 0 };
+	uint32_t			mHierarchyTotal{ 0 };
+	IndexVector			mSceneChunks;			// Chunk holding the results of each scene
+	IndexVector			mHierarchyStart;		// First hierarchy of each scene within its chunk
+	IndexVector			mHierarchyCounts;		// Hierarchies found in each scene
+	IndexVector			mDisconnectedStart;		// First disconnected rigid body of each scene within its chunk
+	IndexVector			mDisconnectedCounts;
+};
+
+HierarchyBatch *HierarchyBatch::create(HierarchyAllocator *allocator)
+{
+	auto ret = new HierarchyBatchImpl(allocator ? allocator : &gDefaultAllocator);
+	return static_cast<HierarchyBatch *>(ret);
+}
+
+class HierarchyKeyHash
+{
+public:
+	size_t operator()(const HierarchyKey &key) const
+	{
+		return size_t(key.mLow);
+	}
+};
+
+class HierarchyKeyEqual
+{
+public:
+	bool operator()(const HierarchyKey &a, const HierarchyKey &b) const
+	{
+		return a.mLow == b.mLow && a.mHigh == b.mHigh;
+	}
+};
+
+class MemoryHierarchyCacheImpl : public MemoryHierarchyCache
+{
+public:
+	class Entry
+	{
+	public:
+		HierarchyKey	mKey;
+		ByteVector		mData;
+	};
+
+	typedef std::list< Entry > EntryList;
+	typedef std::unordered_map< HierarchyKey, EntryList::iterator, HierarchyKeyHash, HierarchyKeyEqual > EntryMap;
+
+	MemoryHierarchyCacheImpl(size_t capacity) : mCapacity(capacity)
+	{
+	}
+
+	virtual bool find(const HierarchyKey &key, const void *&data, size_t &size) override final
+	{
+		bool ret = false;
+
+		auto found = mEntryMap.find(key);
+		if (found != mEntryMap.end())
+		{
+			// Most recently used entries are kept at the front
+			mEntries.splice(mEntries.begin(), mEntries, found->second);
+			data = &found->second->mData[0];
+			size = found->second->mData.size();
+			ret = true;
+		}
+
+		return ret;
+	}
+
+	virtual void store(const HierarchyKey &key, const void *data, size_t size) override final
+	{
+		auto found = mEntryMap.find(key);
+		if (found != mEntryMap.end())
+		{
+			mSize -= found->second->mData.size();
+			mEntries.erase(found->second);
+			mEntryMap.erase(found);
+		}
+		if (size && size <= mCapacity)
+		{
+			while (mSize + size > mCapacity)
+			{
+				Entry &last = mEntries.back();
+				mSize -= last.mData.size();
+				mEntryMap.erase(last.mKey);
+				mEntries.pop_back();
+			}
+			mEntries.emplace_front();
+			Entry &e = mEntries.front();
+			e.mKey = key;
+			e.mData.assign(static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+			mEntryMap[key] = mEntries.begin();
+			mSize += size;
+		}
+	}
+
+	virtual void release(void) override final
+	{
+		delete this;
+	}
+
+	size_t		mCapacity{ 0 };
+	size_t		mSize{ 0 };			// Total bytes of data held
+	EntryList	mEntries;
+	EntryMap	mEntryMap;
+};
+
+MemoryHierarchyCache *MemoryHierarchyCache::create(size_t capacity)
+{
+	auto ret = new MemoryHierarchyCacheImpl(capacity);
+	return static_cast<MemoryHierarchyCache *>(ret);
+}
+
+class DirectoryHierarchyCacheImpl : public DirectoryHierarchyCache
+{
+public:
+	DirectoryHierarchyCacheImpl(const char *directory) : mDirectory(directory)
+	{
+		if (!mDirectory.empty() && mDirectory.back() != '/' && mDirectory.back() != '\\')
+		{
+			mDirectory += '/';
+		}
+	}
+
+	virtual bool find(const HierarchyKey &key, const void *&data, size_t &size) override final
+	{
+		bool ret = false;
+
+		FILE *fph = fopen(getFileName(key).c_str(), "rb");
+		if (fph)
+		{
+			if (fseek(fph, 0, SEEK_END) == 0)
+			{
+				long length = ftell(fph);
+				if (length > 0 && fseek(fph, 0, SEEK_SET) == 0)
+				{
+					mData.resize(size_t(length));
+					if (fread(&mData[0], mData.size(), 1, fph) == 1)
+					{
+						data = &mData[0];
+						size = mData.size();
+						ret = true;
+					}
+				}
+			}
+			fclose(fph);
+		}
+
+		return ret;
+	}
+
+	virtual void store(const HierarchyKey &key, const void *data, size_t size) override final
+	{
+		// Writers in other processes or threads may store the same key at once, so each writes its own
+		// temporary file, named after its process and thread, and the rename decides which complete file is
+		// seen.  Thread ids and addresses can repeat between processes, so the process id is needed too.
+		std::string fileName = getFileName(key);
+		char suffix[64];
+		snprintf(suffix, sizeof(suffix), ".%llx.%llx.tmp", (unsigned long long)getProcessId(), (unsigned long long)(std::hash< std::thread::id >()(std::this_thread::get_id()) ^ uintptr_t(this)));
+		std::string tempName = fileName + suffix;
+		FILE *fph = fopen(tempName.c_str(), "wb");
+		if (fph)
+		{
+			bool written = fwrite(data, size, 1, fph) == 1;
+			written = (fclose(fph) == 0) && written;
+			if (!written || !replaceFile(tempName.c_str(), fileName.c_str()))
+			{
+				remove(tempName.c_str());
+			}
+		}
+	}
+
+	virtual void release(void) override final
+	{
+		delete this;
+	}
 
-		return ret;
+	std::string getFileName(const HierarchyKey &key) const
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "%016llx%016llx.hbr", (unsigned long long)key.mHigh, (unsigned long long)key.mLow);
+		return mDirectory + name;
 	}
 
-	void getLinks(LinkVector &links)
+	static uint64_t getProcessId(void)
 	{
-		links.push_back(this);
-		for (auto &i : mChildren)
-		{
-			i->getLinks(links);
-		}
+#ifdef _WIN32
+		return GetCurrentProcessId();
+#else
+		return uint64_t(getpid());
+#endif
 	}
 
-	virtual const char *getRigidBody(void) const override final
+	static bool replaceFile(const char *source, const char *dest)
 	{
-		return mRigidBody.c_str();
+#ifdef _WIN32
+		return MoveFileExA(source, dest, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return rename(source, dest) == 0;
+#endif
 	}
 
-	bool			mIsLoopJoint{ false };
-	std::string		mJointName;		// Empty string if the root node
-	std::string		mRigidBody;
-	LinkVector		mChildren;
+	std::string	mDirectory;
+	ByteVector	mData;		// The data returned by the last find
 };
 
-class Hierarchy
+DirectoryHierarchyCache *DirectoryHierarchyCache::create(const char *directory)
 {
-public:
-	Hierarchy(const JointRef &joint,size_t index) : mIndex(index)
-	{
-		mRoot					= new Link;
-		mRoot->mRigidBody		= joint.mBody0;
-
-		Link *firstChild		= new Link;
-		firstChild->mJointName	= joint.mName;
-		firstChild->mRigidBody	= joint.mBody1;
-
-		mRoot->mChildren.push_back(firstChild);
-
-#if LOG_CHAIN
-		debugPrint();
-#endif
-	}
+	auto ret = new DirectoryHierarchyCacheImpl(directory);
+	return static_cast<DirectoryHierarchyCache *>(ret);
+}
 
-	virtual ~Hierarchy(void)
+// A read-only memory mapping of an entire file
+class MappedFile
+{
+public:
+	~MappedFile(void)
 	{
-		delete mRoot;
+		unmap();
 	}
 
-	bool merge(Hierarchy *other)
+	bool map(const char *fileName)
 	{
 		bool ret = false;
 
-		JointRefVector joints;
-		other->mRoot->getJointRef(joints); 
-		// get all of the joints in the 'other' hierarchy
-		// Keep iterating on this set of joints while we are successfully adding them
-		// If any joint intersects, then *all* joints should be able to be successfully added.
-		// If not, something is wrong with the design here.
-		bool consumed = true;
-		// While are consuming input joints from this articulation
-		while (consumed)
+#ifdef _WIN32
+		HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file != INVALID_HANDLE_VALUE)
 		{
-			consumed = false;
-			// Iterate through all joints not already merged 
-			for (auto &i : joints)
+			LARGE_INTEGER size;
+			if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
 			{
-				if (!i.mUsed)
+				// The view keeps the mapping alive once both handles are closed
+				HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping)
 				{
-					if (mRoot->isDuplicate(i))
-					{
-						i.mUsed = true;
-					}
-					else if (added(i))
+					mData = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					if (mData)
 					{
+						mSize = uint64_t(size.QuadPart);
 						ret = true;
-						i.mUsed = true;
-						consumed = true;
 					}
+					CloseHandle(mapping);
 				}
 			}
+			CloseHandle(file);
 		}
-		// validation.. if we merged, then 100% of all of the joints should have been consumed..
-#ifdef _DEBUG
-		if (ret)
+#else
+		int fd = open(fileName, O_RDONLY);
+		if (fd >= 0)
 		{
-			for (auto &i : joints)
+			struct stat st;
+			if (fstat(fd, &st) == 0 && st.st_size > 0)
 			{
-				assert(i.mUsed);
+				void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data != MAP_FAILED)
+				{
+					mData = static_cast<const uint8_t *>(data);
+					mSize = uint64_t(st.st_size);
+					ret = true;
+				}
 			}
+			close(fd);
 		}
 #endif
+
 		return ret;
 	}
 
-	// Must find loop joints in the same order they were originally defined!
-	void findLoopJoints(const JointRefVector &joints)
+	void unmap(void)
 	{
-		// Get the list of links as a flat array...
-		LinkVector links;
-		mRoot->getLinks(links);
-		// We are going to now sort them in order..
-		LinkVector sortLinks;
-		for (auto &i : joints)
-		{
-			// for each original source joint...
-			for (auto &j : links)
-			{
-				if (j->mJointName == i.mName)
-				{
-					sortLinks.push_back(j);
-					break;
-				}
-			}
-		}
-		StringVector rigidBodies;
-		rigidBodies.push_back(mRoot->mRigidBody); // add the root node rigid body
-		for (auto &i : sortLinks)
+		if (mData)
 		{
-			bool isLoopJoint = false;
-			for (auto &j : rigidBodies)
-			{
-				if (j == i->mRigidBody)
-				{
-					isLoopJoint = true;
-					break;
-				}
-			}
-			if (isLoopJoint)
-			{
-				i->mIsLoopJoint = true;
-			}
-			else
-			{
-				rigidBodies.push_back(i->mRigidBody);	// add this rigid body to the list of rigid bodies..
-			}
+#ifdef _WIN32
+			UnmapViewOfFile(mData);
+#else
+			munmap(const_cast<uint8_t *>(mData), size_t(mSize));
+#endif
+			mData = nullptr;
+			mSize = 0;
 		}
 	}
 
-	void debugPrint(void)
+	const uint8_t	*mData{ nullptr };
+	uint64_t		mSize{ 0 };
+};
+
+class SnapshotLink;
+
+// One hierarchy of a snapshot along with its HierarchyLink adapters, allocated as a single block
+class SnapshotTree
+{
+public:
+	const char *getBodyName(uint32_t body) const
 	{
-		printf("==========================================================\r\n");
-		printf("Hierarchy[%d] with root node of: %s\r\n", 
-			uint32_t(mIndex),
-			mRoot->mRigidBody.c_str());
-		printf("==========================================================\r\n");
-		mRoot->printChain(0);
-		printf("==========================================================\r\n");
-		printf("\r\n");
+		return mStrings + mBodyNames[body];
 	}
 
-	bool added(const JointRef &jref)
+	const char *getJointName(uint32_t joint) const
 	{
-		bool ret = false;
-
-		Link *l = mRoot->add(jref);
-		ret = l ? true : false;
-#if LOG_CHAIN
-		if (ret)
-		{
-			printf("==========================================================\r\n");
-			printf("Adding: %s-%s\r\n", jref.mBody0.c_str(), jref.mBody1.c_str());
-			printf("==========================================================\r\n");
-			debugPrint();
-			printf("==========================================================\r\n");
-			printf("\r\n");
-		}
-#endif
-		return ret;
+		return mStrings + mJoints[joint].mName;
 	}
 
-	const HierarchyLink * getHierarchyRoot(void) const
+	void printChain(uint32_t node, uint32_t depth) const
 	{
-		return static_cast<const HierarchyLink *>(mRoot);
+		HIERARCHY_BUILDER::printChain(mView, *this, node, depth);
 	}
 
-	size_t		mIndex{ 0 };
-	Link		*mRoot{ nullptr };
+	HierarchyView		mView;
+	const char			*mStrings{ nullptr };
+	const uint32_t		*mBodyNames{ nullptr };
+	const SnapshotJoint	*mJoints{ nullptr };
+	SnapshotLink		*mLinks{ nullptr };
 };
 
-typedef std::vector< Hierarchy *> HierarchyVector;
-
-class HierarchyBuilderImpl : public HierarchyBuilder
+// HierarchyLink adapter over one node of a mapped hierarchy
+class SnapshotLink : public HierarchyLink
 {
 public:
-	HierarchyBuilderImpl(void)
+	virtual void printChain(uint32_t depth) const override final
 	{
-
+		mTree->printChain(mNode, depth);
 	}
 
-	virtual ~HierarchyBuilderImpl(void)
+	virtual uint32_t getChildCount(void) const override final
 	{
-		reset();
+		return mTree->mView.mChildOffsets[mNode + 1] - mTree->mView.mChildOffsets[mNode];
 	}
 
-	virtual void reset(void) override final	// reset back to initial state
+	virtual const char *getJoint(uint32_t index, const char *&body0, const char *&body1, bool &isLoopJoint) const override final
 	{
-		for (auto &i : mHierarchies)
+		const char *ret = nullptr;
+
+		if (index < getChildCount())
 		{
-			delete i;
+			const HierarchyView &v = mTree->mView;
+			uint32_t child = v.mChildOffsets[mNode] + index;
+			ret = mTree->getJointName(v.mJoints[child]);
+			body0 = mTree->getBodyName(v.mRigidBodies[mNode]);
+			body1 = mTree->getBodyName(v.mRigidBodies[child]);
+			isLoopJoint = v.mLoopJoints[child] ? true : false;
 		}
-		mHierarchies.clear();
-		mRigidBodies.clear();
-		mJoints.clear();
-		mDisconnectedRigidBodies.clear();
+
+		return ret;
 	}
 
-	virtual bool addRigidBody(const char *_id) override final	// add a reference to a rigid body by name
+	virtual const HierarchyLink *getChild(uint32_t index) const override final
 	{
-		bool ret = false;
+		const HierarchyLink *ret = nullptr;
 
-		std::string id(_id);
-		if ( !findRigidBodRef(id) )
+		if (index < getChildCount())
 		{
-			RigidBodyRef r;
-			r.mName = id;
-			mRigidBodies.push_back(r);
-			ret = true;
+			ret = static_cast<const HierarchyLink *>(&mTree->mLinks[mTree->mView.mChildOffsets[mNode] + index]);
 		}
 
 		return ret;
 	}
 
-	virtual bool addJoint(const char *_jointId,const char *body0, const char *body1) override final // add a reference to a joint that connects two rigid bodies
+	virtual const char *getRigidBody(void) const override final
 	{
-		bool ret = false;
+		return mTree->getBodyName(mTree->mView.mRigidBodies[mNode]);
+	}
+
+	virtual uint32_t getRigidBodyIndex(void) const override final
+	{
+		return mTree->mView.mRigidBodies[mNode];
+	}
 
-		std::string jointId(_jointId);
+	virtual uint32_t getJointIndex(uint32_t index, uint32_t &body0, uint32_t &body1, bool &isLoopJoint) const override final
+	{
+		uint32_t ret = INVALID_INDEX;
 
-		if ( !findJointRef(jointId ))
+		if (index < getChildCount())
 		{
-			// We cannot add a joint unless it refers to known existing rigid bodies
-			if (findRigidBodRef(body0) && findRigidBodRef(body1))
-			{
-				JointRef j;
-				j.mName = jointId;
-				j.mBody0 = std::string(body0);
-				j.mBody1 = std::string(body1);
-				mJoints.push_back(j);
-				ret = true;
-			}
+			const HierarchyView &v = mTree->mView;
+			uint32_t child = v.mChildOffsets[mNode] + index;
+			ret = v.mJoints[child];
+			body0 = v.mRigidBodies[mNode];
+			body1 = v.mRigidBodies[child];
+			isLoopJoint = v.mLoopJoints[child] ? true : false;
 		}
 
 		return ret;
 	}
 
-	JointRef *findFirstUnusedJoint(void)
-	{
-		JointRef *ret = nullptr;
+	const SnapshotTree	*mTree{ nullptr };
+	uint32_t			mNode{ 0 };
+};
 
-		for (auto &i : mJoints)
-		{
-			if (!i.mUsed)
-			{
-				ret = &i;
-				break;
-			}
-		}
-		return ret;
+class HierarchySnapshotImpl : public HierarchySnapshot
+{
+public:
+	HierarchySnapshotImpl(HierarchyAllocator *allocator) : mAllocator(allocator)
+	{
 	}
 
-	// Build the hierarchy and return the number of unique hierarchies found
-	virtual uint32_t build(void) override final
+	virtual ~HierarchySnapshotImpl(void)
 	{
-		// Step number one, identify all rigid bodies which are not referenced by any joint
-		// and add them to the disconnected rigid bodies list
-		checkForDisconnectedRigidBodies();
-		// Now we try to insert every single joint into an existing hierarchy or, if none fit, start a 
-		// new one
-		JointRef *jref = findFirstUnusedJoint();
-		while (jref)
+		if (mTrees)
 		{
-			bool consumed = false;
-			for (auto &i : mHierarchies)
+			for (uint32_t i = 0; i < mHeader->mHierarchyCount; i++)
 			{
-				if (i->added(*jref))
+				SnapshotTree *tree = mTrees[i].load(std::memory_order_relaxed);
+				if (tree)
 				{
-					consumed = true;
-					break;
+					mAllocator->deallocate(tree);
 				}
 			}
-			jref->mUsed = true;
-			if (!consumed)
-			{
-				Hierarchy *h = new Hierarchy(*jref, mHierarchies.size());
-				mHierarchies.push_back(h);
-			}
-			jref = findFirstUnusedJoint();
+			mAllocator->deallocate(mTrees);
 		}
-		// Once we have added all of the joints, some of the hierarchies may be fragments
-		// This can occur if the joints were added in essentially a randomized order.
-		// This pass we see if any hierarchy fragments can be merged into one single chain
-		// We continue merging until no more merges can happen
-		// We only perform this operation if there is more than one hierarchy found
-		if (mHierarchies.size() > 1) // if we ended up with more than one hierarchy, see if they can be merged into a continguous single hierarachy
+	}
+
+	// Maps the file and checks that every section lies within it, so a truncated file is rejected.  With
+	// HSF_VALIDATE it also checks every index and string table offset the accessors follow, so a corrupt
+	// file is rejected rather than read out of bounds.
+	bool load(const char *fileName, uint32_t flags)
+	{
+		bool ret = false;
+
+		if (mFile.map(fileName) && mFile.mSize >= sizeof(SnapshotHeader))
 		{
-			uint32_t mergeCount = 0;
-			bool mergePass = true;
-			// While we are still merging
-			while (mergePass)
+			const SnapshotHeader &h = *reinterpret_cast<const SnapshotHeader *>(mFile.mData);
+			ret = memcmp(h.mMagic, gSnapshotMagic, sizeof(h.mMagic)) == 0 &&
+				h.mVersion == SNAPSHOT_VERSION &&
+				h.mByteOrder == SNAPSHOT_BYTE_ORDER &&
+				h.mFileSize == mFile.mSize &&
+				h.mStringsSize > 0 &&
+				isSection(h.mStrings, h.mStringsSize, 1) &&
+				isSection(h.mBodyNames, h.mRigidBodyCount, sizeof(uint32_t)) &&
+				isSection(h.mJoints, h.mJointCount, sizeof(SnapshotJoint)) &&
+				isSection(h.mHierarchies, h.mHierarchyCount, sizeof(SnapshotHierarchy)) &&
+				isSection(h.mNodeRigidBodies, h.mNodeCount, sizeof(uint32_t)) &&
+				isSection(h.mNodeJoints, h.mNodeCount, sizeof(uint32_t)) &&
+				isSection(h.mChildOffsets, uint64_t(h.mNodeCount) + h.mHierarchyCount, sizeof(uint32_t)) &&
+				isSection(h.mLoopJoints, h.mNodeCount, 1) &&
+				isSection(h.mDisconnected, h.mDisconnectedCount, sizeof(uint32_t));
+			if (ret)
 			{
-				mergePass = false;
-				for (size_t i = 0; i < mHierarchies.size() && !mergePass; i++)
-				{
-					Hierarchy *source = mHierarchies[i];
-					if (source)
-					{
-						for (size_t j = i + 1; j < mHierarchies.size(); j++)
-						{
-							Hierarchy *dest = mHierarchies[j];
-							if (dest && source->merge(dest))
-							{
-								mergePass = true;
-								delete dest;
-								mHierarchies[j] = nullptr;
-								mergeCount++;
-							}
-						}
-					}
-				}
+				mHeader			= &h;
+				mStrings		= reinterpret_cast<const char *>(mFile.mData + h.mStrings);
+				mBodyNames		= reinterpret_cast<const uint32_t *>(mFile.mData + h.mBodyNames);
+				mJoints			= reinterpret_cast<const SnapshotJoint *>(mFile.mData + h.mJoints);
+				mHierarchies	= reinterpret_cast<const SnapshotHierarchy *>(mFile.mData + h.mHierarchies);
+				mNodeRigidBodies = reinterpret_cast<const uint32_t *>(mFile.mData + h.mNodeRigidBodies);
+				mNodeJoints		= reinterpret_cast<const uint32_t *>(mFile.mData + h.mNodeJoints);
+				mChildOffsets	= reinterpret_cast<const uint32_t *>(mFile.mData + h.mChildOffsets);
+				mLoopJoints		= mFile.mData + h.mLoopJoints;
+				mDisconnected	= reinterpret_cast<const uint32_t *>(mFile.mData + h.mDisconnected);
+				ret = !(flags & HSF_VALIDATE) || isValid();
 			}
-			// If any hierarchies were merged, we rebuild the hierarchy list to remove the
-			// ones which got merged
-			if (mergeCount)
+			if (ret)
 			{
-				// After the merge operation, we rebuild the articulations array with just the merged results
-				HierarchyVector temp = mHierarchies;
-				mHierarchies.clear();
-				for (auto i : temp)
+				// One slot per hierarchy for the HierarchyLink adapters, which are created on demand
+				size_t size = sizeof(std::atomic< SnapshotTree * >) * (h.mHierarchyCount ? h.mHierarchyCount : 1);
+				mTrees = static_cast<std::atomic< SnapshotTree * > *>(mAllocator->allocate(size));
+				for (uint32_t i = 0; i < h.mHierarchyCount; i++)
 				{
-					if (i)
-					{
-						mHierarchies.push_back(i);
-					}
+					new (&mTrees[i]) std::atomic< SnapshotTree * >(nullptr);
 				}
 			}
 		}
-		// Search for and flag any loop joints in each hierarchy
-		for (auto &i : mHierarchies)
-		{
-			i->findLoopJoints(mJoints);
-		}
-
-		return uint32_t(mHierarchies.size());
-	}
 
-	virtual void release(void) override final
-	{
-		delete this;
+		return ret;
 	}
 
-	void checkForDisconnectedRigidBodies(void)
+	// The same checks restoreResult makes on a cached result, plus the names.  The last byte of the string
+	// table is a terminator, so every offset inside it names a terminated string.
+	bool isValid(void) const
 	{
-		mDisconnectedRigidBodies.clear();
-		for (auto &i : mRigidBodies)
+		const SnapshotHeader &h = *mHeader;
+		bool ret = mStrings[h.mStringsSize - 1] == 0;
+		for (uint32_t i = 0; ret && i < h.mRigidBodyCount; i++)
 		{
-			i.mUsed = false;
+			ret = mBodyNames[i] == SNAPSHOT_REMOVED || mBodyNames[i] < h.mStringsSize;
 		}
-		for (auto &i : mJoints)
+		for (uint32_t i = 0; ret && i < h.mJointCount; i++)
 		{
-			// for each joint, find any rigid bodies it refers to and mark them as 'used'
-			for (auto &j : mRigidBodies)
-			{
-				if (!j.mUsed)
-				{
-					// If this rigid body matches the name of either rigid bodies referenced by this
-					// joint, then flag the rigid body as 'used'
-					if (j.mName == i.mBody0 ||
-						j.mName == i.mBody1)
-					{
-						j.mUsed = true; // mark it as being referenced by a joint
-					}
-				}
-			}
+			const SnapshotJoint &j = mJoints[i];
+			ret = j.mName == SNAPSHOT_REMOVED || (j.mName < h.mStringsSize && isLiveRigidBody(j.mBody0) && isLiveRigidBody(j.mBody1));
 		}
-		for (auto &i : mRigidBodies)
+		uint32_t node = 0;
+		for (uint32_t i = 0; ret && i < h.mHierarchyCount; i++)
 		{
-			if (!i.mUsed)
+			uint32_t count = mHierarchies[i].mNodeCount;
+			ret = mHierarchies[i].mFirstNode == node && count >= 1 && count <= h.mNodeCount - node;
+			// The children of every node follow it, so each node other than the root has one parent before it
+			const uint32_t *offsets = mChildOffsets + node + i;
+			ret = ret && offsets[0] == 1;
+			for (uint32_t k = 0; ret && k < count; k++)
 			{
-				mDisconnectedRigidBodies.push_back(i.mName);
+				uint32_t joint = mNodeJoints[node + k];
+				ret = isLiveRigidBody(mNodeRigidBodies[node + k]) &&
+					(k ? joint < h.mJointCount && mJoints[joint].mName != SNAPSHOT_REMOVED : joint == INVALID_INDEX) &&
+					offsets[k] > k && offsets[k] <= offsets[k + 1] && offsets[k + 1] <= count;
 			}
+			ret = ret && offsets[count] == count;
+			node += count;
+		}
+		ret = ret && node == h.mNodeCount;
+		for (uint32_t i = 0; ret && i < h.mDisconnectedCount; i++)
+		{
+			ret = isLiveRigidBody(mDisconnected[i]);
 		}
+		return ret;
+	}
 
+	bool isLiveRigidBody(uint32_t body) const
+	{
+		return body < mHeader->mRigidBodyCount && mBodyNames[body] != SNAPSHOT_REMOVED;
 	}
 
-	// Returns the number of rigid bodies which were not connected by any joints
-	virtual uint32_t getDisconnectedRigidBodyCount(void) override final
+	bool isSection(uint64_t offset, uint64_t count, uint64_t elementSize) const
 	{
-		return uint32_t(mDisconnectedRigidBodies.size());
+		return (offset & 3) == 0 && offset >= sizeof(SnapshotHeader) && offset <= mFile.mSize && count * elementSize <= mFile.mSize - offset;
 	}
 
-	// Returns the name of this disconnected rigid body; null of this index is out of range
-	virtual const char * getDisconnectedRigidBody(uint32_t index) override final
+	virtual uint32_t getHierarchyCount(void) const override final
 	{
-		const char *ret = nullptr;
+		return mHeader->mHierarchyCount;
+	}
 
-		if (index < mDisconnectedRigidBodies.size())
+	virtual const HierarchyLink * getHierarchyRoot(uint32_t index) const override final
+	{
+		const HierarchyLink *ret = nullptr;
+
+		if (index < mHeader->mHierarchyCount)
 		{
-			ret = mDisconnectedRigidBodies[index].c_str();
+			ret = static_cast<const HierarchyLink *>(getTree(index)->mLinks);
 		}
 
 		return ret;
 	}
 
-	void showHierarchy(const HIERARCHY_BUILDER::HierarchyLink *link, uint32_t depth)
+	virtual bool getHierarchyView(uint32_t index, HierarchyView &view) const override final
 	{
-		uint32_t count = link->getChildCount();
-		for (uint32_t i = 0; i < count; i++)
-		{
-			const char *body0;
-			const char *body1;
-			bool isLoopJoint;
-			const char *j = link->getJoint(i, body0, body1, isLoopJoint);
-			for (uint32_t k = 0; k < depth; k++)
-			{
-				printf("    ");
-			}
-			printf("%s : %s->%s : loop(%s)\r\n", j, body0, body1, isLoopJoint ? "true" : "false");
-		}
-		for (uint32_t i = 0; i < count; i++)
+		bool ret = false;
+
+		if (index < mHeader->mHierarchyCount)
 		{
-			const HIERARCHY_BUILDER::HierarchyLink *child = link->getChild(i);
-			showHierarchy(child, depth + 1);
+			const SnapshotHierarchy &h = mHierarchies[index];
+			view.mNodeCount		= h.mNodeCount;
+			view.mRigidBodies	= &mNodeRigidBodies[h.mFirstNode];
+			view.mJoints		= &mNodeJoints[h.mFirstNode];
+			view.mLoopJoints	= &mLoopJoints[h.mFirstNode];
+			view.mChildOffsets	= &mChildOffsets[h.mFirstNode + index];
+			ret = true;
 		}
+
+		return ret;
 	}
 
-	// Debug printf the results
-	// Also works as an example of how to query the results
-	virtual void debugPrint(void) final override
+	// Creates the HierarchyLink adapters of a hierarchy the first time they are needed.  Several threads may
+	// ask at once, so they are created under the lock and published once complete; after that they are only read.
+	SnapshotTree *getTree(uint32_t index) const
 	{
-		uint32_t count = getDisconnectedRigidBodyCount();
-		printf("DisconnectedRigidBodyCount: %d\r\n", count);
-		for (uint32_t i = 0; i < count; i++)
-		{
-			printf("    RigidBody[%d]=%s\r\n", i, getDisconnectedRigidBody(i));
-		}
-		uint32_t hcount = getHierarchyCount();
-		printf("Found %d hierarchies\r\n", hcount);
-		for (uint32_t i = 0; i < hcount; i++)
+		SnapshotTree *ret = mTrees[index].load(std::memory_order_acquire);
+		if (!ret)
 		{
-			printf("========================================================\r\n");
-			printf("Hierarchy[%d]\r\n", i);
-			printf("========================================================\r\n");
-			const HIERARCHY_BUILDER::HierarchyLink *link = getHierarchyRoot(i);
-			showHierarchy(link, 0);
-			printf("========================================================\r\n");
-			printf("\r\n");
+			std::lock_guard< std::mutex > lock(mTreeMutex);
+			ret = mTrees[index].load(std::memory_order_relaxed);
+			if (!ret)
+			{
+				uint32_t nodeCount = mHierarchies[index].mNodeCount;
+				size_t treeSize = (sizeof(SnapshotTree) + 15) & ~size_t(15);
+				uint8_t *mem = static_cast<uint8_t *>(mAllocator->allocate(treeSize + sizeof(SnapshotLink) * nodeCount));
+				ret = new (mem) SnapshotTree;
+				getHierarchyView(index, ret->mView);
+				ret->mStrings	= mStrings;
+				ret->mBodyNames	= mBodyNames;
+				ret->mJoints	= mJoints;
+				ret->mLinks		= reinterpret_cast<SnapshotLink *>(mem + treeSize);
+				for (uint32_t i = 0; i < nodeCount; i++)
+				{
+					SnapshotLink *link = new (&ret->mLinks[i]) SnapshotLink;
+					link->mTree = ret;
+					link->mNode = i;
+				}
+				mTrees[index].store(ret, std::memory_order_release);
+			}
 		}
+		return ret;
 	}
 
-	JointRef *findJointRef(const std::string &id)
+	virtual uint32_t getDisconnectedRigidBodyCount(void) const override final
 	{
-		JointRef *ret = nullptr;
+		return mHeader->mDisconnectedCount;
+	}
 
-		for (auto &i : mJoints)
+	virtual const char * getDisconnectedRigidBody(uint32_t index) const override final
+	{
+		const char *ret = nullptr;
+
+		if (index < mHeader->mDisconnectedCount)
 		{
-			if (i.mName == id)
-			{
-				ret = &i;
-				break;
-			}
+			ret = mStrings + mBodyNames[mDisconnected[index]];
 		}
 
 		return ret;
 	}
 
-	RigidBodyRef * findRigidBodRef(const std::string &id)
+	virtual uint32_t getDisconnectedRigidBodyIndex(uint32_t index) const override final
 	{
-		RigidBodyRef *ret = nullptr;
+		uint32_t ret = INVALID_INDEX;
 
-		for (auto &i : mRigidBodies)
+		if (index < mHeader->mDisconnectedCount)
 		{
-			if (i.mName == id)
-			{
-				ret = &i;
-				break;
-			}
+			ret = mDisconnected[index];
 		}
 
 		return ret;
 	}
 
-	// returns the number of hierarchies found
-	virtual uint32_t getHierarchyCount(void) const override final
+	virtual uint32_t getRigidBodyCount(void) const override final
 	{
-		return uint32_t(mHierarchies.size());
+		return mHeader->mRigidBodyCount;
 	}
 
-	// Return the root link of this hierarchy
-	virtual const HierarchyLink * getHierarchyRoot(uint32_t index) const override final
+	virtual const char *getRigidBody(uint32_t index) const override final
 	{
-		const HierarchyLink *ret = nullptr;
+		const char *ret = nullptr;
 
-		if (index < mHierarchies.size())
+		if (index < mHeader->mRigidBodyCount && mBodyNames[index] != SNAPSHOT_REMOVED)
 		{
-			ret = static_cast<const HierarchyLink *>(mHierarchies[index]->getHierarchyRoot());
+			ret = mStrings + mBodyNames[index];
 		}
 
 		return ret;
 	}
 
-	// Return the number of rigid bodies in the system
-	virtual uint32_t getRigidBodyCount(void) override final
+	virtual uint32_t getJointCount(void) const override final
 	{
-		return uint32_t(mRigidBodies.size());
+		return mHeader->mJointCount;
 	}
 
-	// Return the name of a rigid body input
-	virtual const char *getRigidBody(uint32_t index) override final
+	virtual const char *getJoint(uint32_t index, const char *&body0, const char *&body1) const override final
 	{
 		const char *ret = nullptr;
-		if (index < mRigidBodies.size())
+
+		body0 = nullptr;
+		body1 = nullptr;
+		if (index < mHeader->mJointCount && mJoints[index].mName != SNAPSHOT_REMOVED)
 		{
-			ret = mRigidBodies[index].mName.c_str();
+			const SnapshotJoint &j = mJoints[index];
+			ret = mStrings + j.mName;
+			body0 = mStrings + mBodyNames[j.mBody0];
+			body1 = mStrings + mBodyNames[j.mBody1];
 		}
-		return ret;
-	}
 
-	// Return the number of joints in the system
-	virtual uint32_t getJointCount(void) override final
-	{
-		return uint32_t(mJoints.size());
+		return ret;
 	}
 
-	// Return the name of a joint input and the names of the bodies it connects
-	virtual const char *getJoint(uint32_t index, const char *&body0, const char *&body1) override final
+	virtual bool getJointBodies(uint32_t index, uint32_t &body0, uint32_t &body1) const override final
 	{
-		const char *ret = nullptr;
+		bool ret = false;
 
-		body0 = nullptr;
-		body1 = nullptr;
-		if (index < mJoints.size())
+		body0 = INVALID_INDEX;
+		body1 = INVALID_INDEX;
+		if (index < mHeader->mJointCount && mJoints[index].mName != SNAPSHOT_REMOVED)
 		{
-			const JointRef &j = mJoints[index];
-			ret = j.mName.c_str();
-			body0 = j.mBody0.c_str();
-			body1 = j.mBody1.c_str();
+			body0 = mJoints[index].mBody0;
+			body1 = mJoints[index].mBody1;
+			ret = true;
 		}
 
 		return ret;
 	}
 
+	virtual void release(void) override final
+	{
+		delete this;
+	}
 
 private:
-	RigidBodyRefVector	mRigidBodies;		// Raw collection of source rigid bodies that may, or may not, be connected by joints
-	JointRefVector		mJoints;			// Raw collection of source joints
-	HierarchyVector		mHierarchies;		// number of unique hierarchies found
-	StringVector		mDisconnectedRigidBodies;
+	HierarchyAllocator			*mAllocator;
+	MappedFile					mFile;
+	const SnapshotHeader		*mHeader{ nullptr };
+	const char					*mStrings{ nullptr };
+	const uint32_t				*mBodyNames{ nullptr };
+	const SnapshotJoint			*mJoints{ nullptr };
+	const SnapshotHierarchy		*mHierarchies{ nullptr };
+	const uint32_t				*mNodeRigidBodies{ nullptr };
+	const uint32_t				*mNodeJoints{ nullptr };
+	const uint32_t				*mChildOffsets{ nullptr };
+	const uint8_t				*mLoopJoints{ nullptr };
+	const uint32_t				*mDisconnected{ nullptr };
+	std::atomic< SnapshotTree * >	*mTrees{ nullptr };	// HierarchyLink adapters created so far, indexed by hierarchy
+	mutable std::mutex			mTreeMutex;				// Held while the adapters of a hierarchy are created
 };
 
-HierarchyBuilder *HierarchyBuilder::create(void)
+HierarchySnapshot *HierarchySnapshot::load(const char *fileName, HierarchyAllocator *allocator, uint32_t flags)
 {
-	auto ret = new HierarchyBuilderImpl;
-	return static_cast<HierarchyBuilder *>(ret);
+	HierarchySnapshotImpl *ret = new HierarchySnapshotImpl(allocator ? allocator : &gDefaultAllocator);
+	if (!ret->load(fileName, flags))
+	{
+		delete ret;
+		ret = nullptr;
+	}
+	return static_cast<HierarchySnapshot *>(ret);
 }
 
 
@@ -1,6 +1,14 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Build statistics are gathered unless this is defined as 0, in which case all of the timing and
+// counting code is compiled out and getBuildStats() returns false
+#ifndef HIERARCHY_BUILDER_STATS
+#define HIERARCHY_BUILDER_STATS 1
+#endif
 
 // **********************************************************************************************************
 // This code snippet takes a collection of bodies (by name) and a collection of joints which connect those
@@ -10,8 +18,9 @@
 // The use case for this is if you have an utterly randomized set of rigid bodies and joints and need to
 // derive from it a set of hierarchies (articulations) from the random input dataset.
 //
-// If there are multiple hierarchies, it will detect and return them.  If the input joints are in
-// completely randomized order, it will detect hierarchy fragments and merge them into complete chains.
+// If there are multiple hierarchies, it will detect and return them.  The input joints may be in
+// completely randomized order; connected components are found with a disjoint set over the rigid bodies
+// and each hierarchy is then built with a single traversal, so the cost is roughly linear in the input size.
 // If any of the constraints contain a loop (connects back to itself, then that loop is detected and flagged)
 //
 // Usage is as follows:
@@ -46,6 +55,9 @@
 namespace HIERARCHY_BUILDER
 {
 
+// Returned by the handle based methods when the request is invalid
+const uint32_t INVALID_HANDLE = 0xFFFFFFFF;
+
 // A single link in the hierarchy.  Query the children to get the list of joints
 // associated with this link.
 // Recurse into each child to traverse the entire hierarchy.
@@ -62,19 +74,313 @@ public:
 								const char *&body0, // Name of parent body
 								const char *&body1, // Name of child body
 								bool &isLoopJoint) const = 0; // true if this is a loop joint (refers back to a previous body in the hierarchy)
+	// A loop joint is one which reaches a rigid body the traversal building the hierarchy had already placed,
+	// so its child is a leaf.  Skipping the loop joints leaves a tree which reaches every rigid body of the
+	// hierarchy exactly once.  body0 and body1 are the parent and child link, so for a loop joint reached
+	// from its own body1 they are the joint's bodies in reverse.
 
-	// Returns this child hierarchy link
+	// Returns this child hierarchy link.  The children of a link are ordered by the joints which reach them:
+	// first the joints with this link's rigid body as body0, then those with it as body1, each in the order
+	// the joints were defined.  The order depends only on the joints, not on how they were inserted, so it
+	// can differ from the order of earlier versions when joints are defined before their parent's joint.
 	virtual const HierarchyLink *getChild(uint32_t index) const = 0;
+
+	// Returns the handle of the rigid body for this link
+	virtual uint32_t getRigidBodyIndex(void) const = 0;
+
+	// Returns the handle of the joint and bodies for this child; INVALID_HANDLE if the index is out of range
+	virtual uint32_t getJointIndex(uint32_t index,	// Child index
+								uint32_t &body0,	// Handle of parent body
+								uint32_t &body1,	// Handle of child body
+								bool &isLoopJoint) const = 0; // true if this is a loop joint
+};
+
+// Flat, read-only view of a built hierarchy in compressed sparse row form.
+// Nodes are stored breadth first with node 0 as the root, so the children of node 'n' are the
+// contiguous nodes mChildOffsets[n] up to (but not including) mChildOffsets[n+1].
+// Every node other than the root is reached from its parent through the joint mJoints[n].
+// The arrays are owned by the HierarchyBuilder and remain valid until the next build, reset or release.
+class HierarchyView
+{
+public:
+	uint32_t		mNodeCount{ 0 };
+	const uint32_t	*mRigidBodies{ nullptr };	// Rigid body handle of each node
+	const uint32_t	*mJoints{ nullptr };		// Handle of the joint from the parent to each node; INVALID_HANDLE for the root
+	const uint8_t	*mLoopJoints{ nullptr };	// Non-zero if the joint from the parent to this node is a loop joint
+	const uint32_t	*mChildOffsets{ nullptr };	// mNodeCount+1 entries
+};
+
+// Visits every node of a hierarchy in pre-order straight from its flat view.  The visitor is called
+// directly rather than through the HierarchyLink interface, so its methods can be inlined:
+//
+//   void onLink(uint32_t rigidBody,uint32_t depth);						// Every node, parents before children
+//   void onJoint(uint32_t joint,uint32_t body0,uint32_t body1);			// The joint to a child, just before its onLink
+//   void onLoopJoint(uint32_t joint,uint32_t body0,uint32_t body1);		// Instead of onJoint if this is a loop joint
+//
+// body0 is the parent rigid body and body1 the child, as for HierarchyLink::getJointIndex.  The nodes are
+// the ones reached by walking the HierarchyLink interface depth first, in the same order.
+template< typename Visitor > void visitHierarchy(const HierarchyView &view,Visitor &visitor)
+{
+	struct Frame
+	{
+		uint32_t	mNode;
+		uint32_t	mParent;
+		uint32_t	mDepth;
+	};
+	std::vector< Frame > stack;
+	if (view.mNodeCount)
+	{
+		stack.push_back(Frame{ 0, INVALID_HANDLE, 0 });
+	}
+	while (!stack.empty())
+	{
+		Frame f = stack.back();
+		stack.pop_back();
+		uint32_t body = view.mRigidBodies[f.mNode];
+		if (f.mParent != INVALID_HANDLE)
+		{
+			if (view.mLoopJoints[f.mNode])
+			{
+				visitor.onLoopJoint(view.mJoints[f.mNode],view.mRigidBodies[f.mParent],body);
+			}
+			else
+			{
+				visitor.onJoint(view.mJoints[f.mNode],view.mRigidBodies[f.mParent],body);
+			}
+		}
+		visitor.onLink(body,f.mDepth);
+		// Pushed in reverse so the first child is visited first
+		for (uint32_t i = view.mChildOffsets[f.mNode + 1]; i > view.mChildOffsets[f.mNode]; i--)
+		{
+			stack.push_back(Frame{ i - 1, f.mNode, f.mDepth + 1 });
+		}
+	}
+}
+
+// Depth first layout of a built hierarchy in the parent array form used by articulated body solvers.
+// Each rigid body appears exactly once and after its parent, so a forward scan over the arrays visits
+// parents before children and a backward scan visits children before parents.  The subtree of body 'i'
+// is the contiguous bodies i up to (but not including) mSubtreeEnds[i].
+// The joints from each body to its parent form a spanning tree and every other joint of the hierarchy is
+// listed separately as a loop joint.  These are exactly the joints flagged by isLoopJoint.
+// The arrays are owned by the HierarchyBuilder and remain valid until the next build, reset or release.
+class DepthFirstView
+{
+public:
+	uint32_t		mBodyCount{ 0 };
+	const uint32_t	*mRigidBodies{ nullptr };	// Rigid body handle of each body; body 0 is the root
+	const uint32_t	*mParents{ nullptr };		// Depth first index of the parent of each body; INVALID_HANDLE for the root
+	const uint32_t	*mJoints{ nullptr };		// Handle of the joint from the parent to each body; INVALID_HANDLE for the root
+	const uint32_t	*mSubtreeEnds{ nullptr };	// One past the last body in the subtree of each body
+	uint32_t		mLoopJointCount{ 0 };
+	const uint32_t	*mLoopJoints{ nullptr };	// Handle of each loop joint, in the order the traversal reached them
+	const uint32_t	*mLoopBodies0{ nullptr };	// Depth first index of body0 of each loop joint
+	const uint32_t	*mLoopBodies1{ nullptr };	// Depth first index of body1 of each loop joint
+};
+
+// Optional allocator hook.  The HierarchyBuilder places all of the built hierarchies in an arena
+// and requests memory for it from this interface in large blocks.  A HierarchyBatch building on several
+// threads (BuildOptions::mThreadCount or mTaskScheduler) calls it from all of them at once, so an
+// allocator shared that way must be thread safe.
+class HierarchyAllocator
+{
+public:
+	virtual void *allocate(size_t size) = 0;
+	virtual void deallocate(void *mem) = 0;
+};
+
+// Optional task scheduler used to build independent hierarchies in parallel
+typedef void (*HierarchyTask)(void *userData,uint32_t index);
+
+class HierarchyTaskScheduler
+{
+public:
+	// Run task(userData,index) for every index in [0,count) and return once all of them have completed.
+	// The tasks are independent of each other and may run concurrently in any order.
+	virtual void parallelFor(uint32_t count,HierarchyTask task,void *userData) = 0;
+};
+
+// 128 bit hash identifying the inputs of a build
+class HierarchyKey
+{
+public:
+	uint64_t	mLow{ 0 };
+	uint64_t	mHigh{ 0 };
+};
+
+// Optional cache of build results.  The key is a hash of every rigid body and joint added to or removed
+// from the builder, in order, combined with the build options which affect the result.  On a hit, build()
+// restores the hierarchies and disconnected rigid bodies from the cached data instead of building them.
+// Cached data is checked against the current inputs before it is used, and is ignored if it does not match.
+class HierarchyCache
+{
+public:
+	// Return the data stored for this key; false if there is none.  The data must remain valid until the
+	// next call to the cache.
+	virtual bool find(const HierarchyKey &key,const void *&data,size_t &size) = 0;
+
+	// Keep a copy of the data for this key
+	virtual void store(const HierarchyKey &key,const void *data,size_t size) = 0;
+};
+
+// In memory cache which drops the least recently used results once they take more than 'capacity' bytes.
+// It is not thread safe, so builders running concurrently each need their own.
+class MemoryHierarchyCache : public HierarchyCache
+{
+public:
+	static MemoryHierarchyCache *create(size_t capacity);
+
+	virtual void release(void) = 0;
+protected:
+	virtual ~MemoryHierarchyCache(void)
+	{
+	}
+};
+
+// Cache which keeps each result as a file, named after its key, in an existing directory, so results are
+// shared between processes and runs.  Files are written under a temporary name and then renamed into place.
+class DirectoryHierarchyCache : public HierarchyCache
+{
+public:
+	static DirectoryHierarchyCache *create(const char *directory);
+
+	virtual void release(void) = 0;
+protected:
+	virtual ~DirectoryHierarchyCache(void)
+	{
+	}
+};
+
+// How the root rigid body of each hierarchy is chosen
+enum RootPolicy
+{
+	// Start at body0 of the first joint of the component and walk up through the first incoming joint of each
+	// body until a body with no parent is found.
+	ROOT_FIRST_JOINT,
+	// The first rigid body from BuildOptions::mRootBodies which is in the component; components with none
+	// of them fall back to ROOT_FIRST_JOINT.
+	ROOT_SPECIFIED,
+	// The center of the component's spanning tree, giving the minimum height.  This is exact for components
+	// without loops; with loops it is the center of the spanning tree found from the ROOT_FIRST_JOINT root.
+	ROOT_TREE_CENTER,
+	// The rigid body referenced by the most joints; the first one in joint definition order on a tie.
+	ROOT_MAX_DEGREE
+};
+
+// Options controlling how build() runs
+class BuildOptions
+{
+public:
+	// Number of threads used to build independent hierarchies; 0 uses every hardware thread.
+	// The result, including the order of the hierarchies, is the same for any thread count.
+	uint32_t				mThreadCount{ 1 };
+	// If provided, the hierarchies are built as tasks on this scheduler instead of internal threads.
+	// mThreadCount is then used as a hint for how many tasks to create.
+	HierarchyTaskScheduler	*mTaskScheduler{ nullptr };
+	// Root selection.  Whatever the policy, the loop joints are exactly the joints which reach a rigid body
+	// already in the tree, so the remaining joints always form a spanning tree from the root.
+	// The policy, and a copy of the root bodies, also apply to the incremental updates which follow this build.
+	RootPolicy				mRootPolicy{ ROOT_FIRST_JOINT };
+	const uint32_t			*mRootBodies{ nullptr };	// Rigid body handles for ROOT_SPECIFIED, in order of preference
+	uint32_t				mRootBodyCount{ 0 };
+	// Also lay out every hierarchy depth first for getDepthFirstView.  This costs another four indices per
+	// node and is kept for the incremental updates which follow this build.
+	bool					mDepthFirstView{ false };
+	// Components whose joints, in definition order, connect their rigid bodies in the same pattern (such as
+	// many copies of one robot) build identical hierarchies apart from the handles.  If set, only the first
+	// of each is traversed; the others reuse its child offsets and loop flags and store just their own
+	// handles.  Queries are unaffected.  Ignored with ROOT_SPECIFIED.
+	bool					mShareStructure{ false };
+	// If provided, the result is looked up here first and stored here after it is built
+	HierarchyCache			*mCache{ nullptr };
+	// Only find the components and disconnected rigid bodies in build().  The tree, loop flags and depth first
+	// layout of each hierarchy are built the first time it is looked at through getHierarchyRoot,
+	// getHierarchyView, getDepthFirstView or visit, which may happen from several threads at once.  Structure
+	// sharing does not apply, and a cache miss still builds every hierarchy so that the result can be stored.
+	bool					mLazy{ false };
+	// Also build, for every hierarchy, a table of about log2(N) indices per node over the depth first layout
+	// so that getLowestCommonAncestor is O(1) and getJointPath is O(path length).  Implies mDepthFirstView,
+	// which on its own is enough for isAncestor.  Kept for the incremental updates which follow this build.
+	bool					mPathQueries{ false };
+};
+
+// Flags for HierarchyBuilder::create
+enum HierarchyBuilderFlags
+{
+	// The names passed to addRigidBody and addJoint outlive the builder (or the next reset), for example
+	// because they live in a long lived string pool.  The builder keeps only the pointers, never copies
+	// a name, and every query returns the same pointers that were passed in.
+	HBF_BORROW_NAMES = (1<<0),
+	// Keep the copied names front coded: each name stores only the characters which differ from the name
+	// added before it, which removes most of the memory used by structured names such as
+	// "robot_0173/l_gripper_finger_link".  Returned names are decoded on demand into a few buffers owned by
+	// the calling thread, so a name returned by the builder or its hierarchies stays valid only until eight
+	// more names have been returned on that thread, counting those debugPrint asks for as it prints; copy it
+	// to keep it.  Adding, looking up, hashing and saving names decode into separate buffers, so they never
+	// invalidate a returned name.  Ignored with HBF_BORROW_NAMES.
+	HBF_COMPRESS_NAMES = (1<<1)
+};
+
+// Statistics reported by HierarchyBuilder::getBuildStats
+class BuildStats
+{
+public:
+	// Wall time of each phase of the most recent build(), in milliseconds
+	double		mReleaseTime{ 0 };				// Freeing the hierarchies of the previous build
+	double		mDisconnectedTime{ 0 };			// Finding the rigid bodies which are not referenced by any joint
+	double		mComponentTime{ 0 };			// Disjoint set pass and bucketing the joints by component
+	double		mShareTime{ 0 };				// Finding the components with the same structure, if sharing
+	double		mCacheTime{ 0 };				// Looking up and restoring or storing the result, if there is a cache
+	bool		mCacheHit{ false };				// True if the result was restored from the cache
+	double		mAllocateTime{ 0 };				// Allocating the flat node storage for every hierarchy
+	double		mTreeTime{ 0 };					// Traversing, laying out and flagging the loop joints of every hierarchy
+	double		mTotalTime{ 0 };
+
+	// Operation counters for the most recent build()
+	uint32_t	mRigidBodyCount{ 0 };
+	uint32_t	mJointCount{ 0 };				// Joints which were not removed
+	uint32_t	mComponentCount{ 0 };
+	uint32_t	mTaskCount{ 0 };				// Build tasks the components were split into
+	uint64_t	mRootSteps{ 0 };				// Rigid bodies visited while walking up to the root of each hierarchy
+	uint64_t	mTraversalSteps{ 0 };			// Joint list entries visited by the depth first traversals
+	uint32_t	mLoopJointCount{ 0 };
+	uint32_t	mSharedHierarchyCount{ 0 };		// Hierarchies which reuse the structure of an earlier one
+	uint32_t	mLazyHierarchyCount{ 0 };		// Hierarchies of a lazy build which have been built so far
+
+	// Incremental updates applied since the most recent build()
+	uint32_t	mUpdateCount{ 0 };
+	uint32_t	mRebuiltHierarchyCount{ 0 };
+	double		mUpdateTime{ 0 };
+
+	// The current results
+	uint32_t	mHierarchyCount{ 0 };
+	uint32_t	mNodeCount{ 0 };
+	uint32_t	mDisconnectedCount{ 0 };
+
+	// Memory, in bytes
+	uint32_t	mArenaBlockCount{ 0 };			// Blocks requested from the allocator for the arena
+	uint64_t	mArenaReservedBytes{ 0 };
+	uint64_t	mArenaUsedBytes{ 0 };
+	uint32_t	mOwnedAllocationCount{ 0 };		// Hierarchies rebuilt by incremental updates, each allocated on its own
+	uint64_t	mOwnedBytes{ 0 };
+	uint64_t	mRetainedBytes{ 0 };			// Everything currently held by the builder: inputs, names, scratch state and results
+	uint64_t	mNameBytes{ 0 };				// The part of mRetainedBytes holding the rigid body and joint names
+	uint64_t	mPeakBytes{ 0 };				// Highest retained size, including temporaries, at the end of any build or update
 };
 
 class HierarchyBuilder
 {
 public:
-	// Create an instance of the HierarchyBuilder class
-	static HierarchyBuilder *create(void);
+	// Create an instance of the HierarchyBuilder class.  If no allocator is provided the arena uses malloc/free.
+	// The allocator must remain valid until the HierarchyBuilder is released.  'flags' is any combination
+	// of HierarchyBuilderFlags.
+	static HierarchyBuilder *create(HierarchyAllocator *allocator=nullptr,uint32_t flags=0);
 
 	virtual void reset(void) = 0;	// reset back to initial state
 
+	// Return the HierarchyBuilderFlags the builder was created with
+	virtual uint32_t getFlags(void) const = 0;
+
 	// Add a reference to a rigid body by unique id, must be unique.  Returns false if the name already exists.
 	virtual bool addRigidBody(const char *id) = 0;	// add a reference to a rigid body by name
 
@@ -83,21 +389,121 @@ public:
 	// two rigid bodies.  If the joint name is duplicate, it will return false.
 	virtual bool addJoint(const char *jointId,const char *body0,const char *body1) = 0; // add a reference to a joint that connects two rigid bodies
 
+	// Handle based versions of the methods above for callers which do not need names.
+	// Handles are dense and assigned in the order rigid bodies and joints are added, whether by name or not,
+	// so they are the same indices used by getRigidBody() and getJoint().  Unnamed bodies and joints
+	// report an empty string as their name.
+
+	// Add an unnamed rigid body and return its handle
+	virtual uint32_t addRigidBody(void) = 0;
+
+	// Add an unnamed joint connecting two rigid body handles and return its handle; INVALID_HANDLE if
+	// either rigid body handle is out of range
+	virtual uint32_t addJoint(uint32_t body0,uint32_t body1) = 0;
+
+	// Add a named joint connecting two rigid body handles, whether those rigid bodies are named or not, and
+	// return its handle; INVALID_HANDLE if either rigid body handle is out of range or the name already exists
+	virtual uint32_t addJoint(const char *jointId,uint32_t body0,uint32_t body1) = 0;
+
+	// Bulk ingestion.  These behave exactly like calling the single versions for each entry in turn, but
+	// make room for the whole batch up front.  Each returns the number of entries actually added.
+	virtual uint32_t addRigidBodies(const char * const *ids,uint32_t count) = 0;
+	virtual uint32_t addJoints(const char * const *jointIds,const char * const *body0,const char * const *body1,uint32_t count) = 0;
+	// Adds unnamed joints between rigid body handles; pairs with an invalid handle are skipped
+	virtual uint32_t addJoints(const uint32_t *body0,const uint32_t *body1,uint32_t count) = 0;
+
+	// Hint for the total number of rigid bodies and joints which will be added, so storage is only sized once
+	virtual void reserve(uint32_t bodyCount,uint32_t jointCount) = 0;
+
+	// Return the hash of every rigid body and joint added or removed, in order, since creation or the last reset.
+	// Builders given exactly the same calls report the same key, whether or not they borrow names.
+	virtual HierarchyKey getInputKey(void) const = 0;
+
+	// Look up the handle of a named rigid body or joint; INVALID_HANDLE if it does not exist
+	virtual uint32_t getRigidBodyHandle(const char *id) = 0;
+	virtual uint32_t getJointHandle(const char *jointId) = 0;
+
+	// Remove a joint.  Returns false if the handle is out of range or was already removed.
+	// Handles are never reused; a removed joint reports a null name and its name may be added again.
+	virtual bool removeJoint(uint32_t jointHandle) = 0;
+
+	// Remove a rigid body and every joint which references it.  Returns false if the handle is out of
+	// range or was already removed.
+	virtual bool removeRigidBody(uint32_t bodyHandle) = 0;
+
 	// Build the hierarchy and return the number of unique hierarchies found
 	virtual uint32_t build(void) = 0;
 
+	// Build the hierarchy with these options and return the number of unique hierarchies found
+	virtual uint32_t build(const BuildOptions &options) = 0;
+
 	// Returns the number of rigid bodies which were not connected by any joints
 	virtual uint32_t getDisconnectedRigidBodyCount(void) = 0;
 
 	// Returns the name of this disconnected rigid body; null if this index is out of range
 	virtual const char * getDisconnectedRigidBody(uint32_t index) = 0;
 
+	// Returns the handle of this disconnected rigid body; INVALID_HANDLE if this index is out of range
+	virtual uint32_t getDisconnectedRigidBodyIndex(uint32_t index) = 0;
+
 	// returns the number of hierarchies found
 	virtual uint32_t getHierarchyCount(void) const = 0;
 
 	// Return the root link of this hierarchy
 	virtual const HierarchyLink * getHierarchyRoot(uint32_t index) const = 0;
 
+	// Incremental updates.  Once build() has been called, adding or removing rigid bodies and joints
+	// immediately rebuilds only the hierarchies which contain the bodies involved, splitting and merging
+	// them as needed.  A rebuilt hierarchy keeps the position of one it replaces; a hierarchy which is no
+	// longer needed is replaced by the last one in the list.  The positions of every hierarchy which changed
+	// or moved are reported here until cleared.  A full build() restores the definition order of the hierarchies.
+	virtual uint32_t getDirtyHierarchyCount(void) const = 0;
+	virtual uint32_t getDirtyHierarchy(uint32_t index) const = 0;
+	virtual void clearDirtyHierarchies(void) = 0;
+
+	// Return the flat view of this hierarchy; false if the index is out of range.
+	// The HierarchyLink interface is an adapter over this same storage.
+	virtual bool getHierarchyView(uint32_t index,HierarchyView &view) const = 0;
+
+	// Visit this hierarchy with visitHierarchy; false if the index is out of range
+	template< typename Visitor > bool visit(uint32_t index,Visitor &visitor) const
+	{
+		HierarchyView view;
+		bool ret = getHierarchyView(index,view);
+		if (ret)
+		{
+			visitHierarchy(view,visitor);
+		}
+		return ret;
+	}
+
+	// Return the depth first layout of this hierarchy; false if the index is out of range or the last
+	// build() did not set BuildOptions::mDepthFirstView.
+	virtual bool getDepthFirstView(uint32_t index,DepthFirstView &view) const = 0;
+
+	// Queries between two rigid bodies of the same hierarchy, over the depth first layout of the last build()
+	// and the incremental updates since.  Loop joints are never part of a path.
+
+	// True if 'ancestor' lies on the tree path from the root of its hierarchy to 'body', not counting 'body'
+	// itself.  O(1); always false without BuildOptions::mDepthFirstView.
+	virtual bool isAncestor(uint32_t ancestor, uint32_t body) const = 0;
+	// Return the deepest rigid body which is an ancestor of both, or is one of them.  O(1); INVALID_HANDLE if
+	// the bodies are in different hierarchies or build() did not set BuildOptions::mPathQueries.
+	virtual uint32_t getLowestCommonAncestor(uint32_t body0, uint32_t body1) const = 0;
+	// Copy the handles of the tree joints on the path from 'body0' to 'body1' into 'joints', in order, up to
+	// 'maxJoints' of them, and return how many there are.  INVALID_HANDLE under the same conditions as
+	// getLowestCommonAncestor.
+	virtual uint32_t getJointPath(uint32_t body0, uint32_t body1, uint32_t *joints, uint32_t maxJoints) const = 0;
+
+	// Return the statistics of the most recent build() along with the current memory use.
+	// Returns false, leaving 'stats' untouched, if HIERARCHY_BUILDER_STATS is 0.
+	virtual bool getBuildStats(BuildStats &stats) const = 0;
+
+	// Write the built hierarchies, with the names and handles of every rigid body and joint, to a binary
+	// snapshot file which HierarchySnapshot::load can map back in.  Returns false if build() has not been
+	// called or the file could not be written.
+	virtual bool save(const char *fileName) = 0;
+
 	// Debug printf the results
 	virtual void debugPrint(void) = 0;
 
@@ -112,6 +518,14 @@ public:
 	virtual uint32_t getJointCount(void) = 0;
 	// Return the name of a joint input and the names of the bodies it connects
 	virtual const char *getJoint(uint32_t index, const char *&body0, const char *&body1) = 0;
+	// Return the handles of the bodies a joint input connects; false if the index is out of range
+	virtual bool getJointBodies(uint32_t index, uint32_t &body0, uint32_t &body1) = 0;
+	// Return the number of joint ends at a rigid body, so a joint from a body to itself counts twice; zero if
+	// the handle is out of range.  Kept up to date as joints are added and removed.
+	virtual uint32_t getBodyDegree(uint32_t body) = 0;
+	// Copy the handles of the joints touching a rigid body into 'joints', in definition order, up to
+	// 'maxJoints' of them, and return how many there are.  Each joint is listed once.
+	virtual uint32_t getBodyJoints(uint32_t body, uint32_t *joints, uint32_t maxJoints) = 0;
 
 	// Release the HierarchyBuilder instance
 	virtual void release(void) = 0;
@@ -121,4 +535,132 @@ protected:
 	}
 };
 
+// A set of independent scenes for HierarchyBatch::build.  The rigid bodies of every scene are unnamed and
+// have the handles 0 up to mBodyCounts[s] within their scene.  The joints of all of the scenes are stored
+// back to back: the joints of scene 's' are entries mJointOffsets[s] up to mJointOffsets[s+1] of mJointBody0
+// and mJointBody1, which hold rigid body handles within that scene.
+class BatchScenes
+{
+public:
+	uint32_t		mSceneCount{ 0 };
+	const uint32_t	*mBodyCounts{ nullptr };	// mSceneCount entries
+	const uint32_t	*mJointOffsets{ nullptr };	// mSceneCount+1 entries
+	const uint32_t	*mJointBody0{ nullptr };
+	const uint32_t	*mJointBody1{ nullptr };
+};
+
+// Builds the hierarchies of many independent scenes in one call.  The scenes are split into tasks which
+// run on the threads or task scheduler given by the build options, and each task reuses one builder for
+// all of its scenes, so there is no per scene setup.  Each task copies the results of its scenes once, out of
+// its builder and into storage of its own which the views point into, and keeps them until the next build or
+// release.
+//
+// Each scene is built exactly as a HierarchyBuilder would build it with the same joints added by handle,
+// so the hierarchies, their order and the handles are the same.  As with HierarchyBuilder::addJoints, a
+// joint which refers to a rigid body outside its scene is skipped and does not take a handle.
+class HierarchyBatch
+{
+public:
+	// Create an instance of the HierarchyBatch class.  If no allocator is provided malloc/free are used.
+	// The allocator is called from every thread of a parallel build and must be thread safe.
+	static HierarchyBatch *create(HierarchyAllocator *allocator=nullptr);
+
+	// Build every scene, replacing the results of the previous build, and return the total number of
+	// hierarchies found.  The root policy applies to each scene, with the mRootBodies handles taken within
+	// each scene, and mShareStructure applies within each scene.  mDepthFirstView, mPathQueries, mCache and
+	// mLazy are ignored.
+	virtual uint32_t build(const BatchScenes &scenes,const BuildOptions &options) = 0;
+
+	virtual uint32_t getSceneCount(void) const = 0;
+
+	// Return the number of hierarchies found in this scene
+	virtual uint32_t getHierarchyCount(uint32_t scene) const = 0;
+
+	// Return the flat view of a hierarchy of this scene; false if either index is out of range
+	virtual bool getHierarchyView(uint32_t scene,uint32_t index,HierarchyView &view) const = 0;
+
+	// Visit a hierarchy of this scene with visitHierarchy; false if either index is out of range
+	template< typename Visitor > bool visit(uint32_t scene,uint32_t index,Visitor &visitor) const
+	{
+		HierarchyView view;
+		bool ret = getHierarchyView(scene,index,view);
+		if (ret)
+		{
+			visitHierarchy(view,visitor);
+		}
+		return ret;
+	}
+
+	// Returns the number of rigid bodies in this scene which were not connected by any joints
+	virtual uint32_t getDisconnectedRigidBodyCount(uint32_t scene) const = 0;
+
+	// Returns the handle of this disconnected rigid body; INVALID_HANDLE if either index is out of range
+	virtual uint32_t getDisconnectedRigidBodyIndex(uint32_t scene,uint32_t index) const = 0;
+
+	// Release the HierarchyBatch instance
+	virtual void release(void) = 0;
+protected:
+	virtual ~HierarchyBatch(void)
+	{
+	}
+};
+
+// Flags for HierarchySnapshot::load
+enum HierarchySnapshotFlags
+{
+	// Also check every index and name offset in the file, so a corrupt file is rejected instead of being read
+	// out of bounds by the queries.  This reads the whole file, so it costs time proportional to its size;
+	// use it for files which were not written by this process or may have been damaged since.
+	HSF_VALIDATE = (1<<0)
+};
+
+// Read-only results of a build, loaded from a file written by HierarchyBuilder::save.
+// The file is memory mapped and every query is answered straight from the mapped pages; nothing is parsed
+// or copied on load.  Besides one pointer per hierarchy, the only allocation is the HierarchyLink adapters
+// for a hierarchy, which are created the first time getHierarchyRoot is called for it.  Every query may be
+// called from several threads at once.  Handles, names and hierarchy order are exactly those of the builder
+// when it was saved.
+class HierarchySnapshot
+{
+public:
+	// Map a snapshot file; returns null if the file cannot be opened, is not a snapshot of this version or
+	// has a section which does not fit in the file.  This only reads the header, so the cost does not depend
+	// on the size of the file.  The allocator is only used for the HierarchyLink adapters and must remain
+	// valid until release.  'flags' is any combination of HierarchySnapshotFlags.
+	static HierarchySnapshot *load(const char *fileName,HierarchyAllocator *allocator=nullptr,uint32_t flags=0);
+
+	virtual uint32_t getHierarchyCount(void) const = 0;
+	virtual const HierarchyLink * getHierarchyRoot(uint32_t index) const = 0;
+	virtual bool getHierarchyView(uint32_t index,HierarchyView &view) const = 0;
+
+	// Visit this hierarchy with visitHierarchy; false if the index is out of range
+	template< typename Visitor > bool visit(uint32_t index,Visitor &visitor) const
+	{
+		HierarchyView view;
+		bool ret = getHierarchyView(index,view);
+		if (ret)
+		{
+			visitHierarchy(view,visitor);
+		}
+		return ret;
+	}
+
+	virtual uint32_t getDisconnectedRigidBodyCount(void) const = 0;
+	virtual const char * getDisconnectedRigidBody(uint32_t index) const = 0;
+	virtual uint32_t getDisconnectedRigidBodyIndex(uint32_t index) const = 0;
+
+	virtual uint32_t getRigidBodyCount(void) const = 0;
+	virtual const char *getRigidBody(uint32_t index) const = 0;
+	virtual uint32_t getJointCount(void) const = 0;
+	virtual const char *getJoint(uint32_t index, const char *&body0, const char *&body1) const = 0;
+	virtual bool getJointBodies(uint32_t index, uint32_t &body0, uint32_t &body1) const = 0;
+
+	// Unmap the file and release the HierarchySnapshot instance
+	virtual void release(void) = 0;
+protected:
+	virtual ~HierarchySnapshot(void)
+	{
+	}
+};
+
 } // End of the HIERARCHY_BUILDER namespace
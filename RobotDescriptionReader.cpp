@@ -0,0 +1,700 @@
+#include "RobotDescriptionReader.h"
+#include "HierarchyBuilder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100 4996)
+#endif
+
+namespace HIERARCHY_BUILDER
+{
+
+// A reference to characters in the input; never null terminated
+class StringRef
+{
+public:
+	bool equals(const char *str) const
+	{
+		size_t len = strlen(str);
+		return len == mLength && memcmp(mData, str, len) == 0;
+	}
+
+	const char	*mData{ nullptr };
+	size_t		mLength{ 0 };
+};
+
+// What an open element means to the reader
+enum ElementKind
+{
+	EK_OTHER,
+	EK_LINK,		// URDF or SDF rigid body
+	EK_JOINT,		// URDF or SDF joint
+	EK_PARENT,		// Parent of a URDF or SDF joint
+	EK_CHILD,		// Child of a URDF or SDF joint
+	EK_BODY			// MJCF rigid body
+};
+
+class Element
+{
+public:
+	ElementKind	mKind{ EK_OTHER };
+	uint32_t	mBody{ INVALID_HANDLE };		// MJCF rigid body handle
+	uint32_t	mParentBody{ INVALID_HANDLE };	// Handle of the enclosing MJCF rigid body
+	bool		mConnected{ false };			// True once this MJCF body has been joined to its parent
+};
+
+typedef std::vector< Element > ElementVector;
+
+// A joint whose rigid bodies had not been defined yet when it was read
+class PendingJoint
+{
+public:
+	std::string	mName;
+	std::string	mBody0;
+	std::string	mBody1;
+};
+
+typedef std::vector< PendingJoint > PendingJointVector;
+
+class RobotDescriptionParser
+{
+public:
+	RobotDescriptionParser(HierarchyBuilder *hb) : mBuilder(hb)
+	{
+	}
+
+	bool parseFile(const char *fileName)
+	{
+		bool ret = false;
+
+		mFile = fopen(fileName, "rb");
+		if (mFile)
+		{
+			mBuffer.resize(CHUNK_SIZE);
+			mData = &mBuffer[0];
+			mSize = 0;
+			mPos = 0;
+			mEnd = false;
+			refill();
+			ret = parse();
+			fclose(mFile);
+			mFile = nullptr;
+		}
+
+		return ret;
+	}
+
+	bool parseBuffer(const char *data, size_t size)
+	{
+		mData = data;
+		mSize = size;
+		mPos = 0;
+		mEnd = true;
+		mStats.mBytesRead = size;
+		return parse();
+	}
+
+	// Tokenizes the input one piece of markup at a time.  Markup which runs past the end of the data
+	// read so far is completed by reading the next chunk.
+	bool parse(void)
+	{
+		bool ret = true;
+
+		for (;;)
+		{
+			const char *start = mData + mPos;
+			const char *end = mData + mSize;
+			const char *lt = static_cast<const char *>(memchr(start, '<', size_t(end - start)));
+			if (!lt)
+			{
+				text(start, end);
+				mPos = mSize;
+				if (!refill())
+				{
+					break;
+				}
+				continue;
+			}
+			text(start, lt);
+			mPos = size_t(lt - mData);
+			bool atEnd = mEnd;
+			const char *gt = findMarkupEnd(lt, end);
+			if (!gt)
+			{
+				// Once the end is reached the markup is examined one last time
+				if (refill() || !atEnd)
+				{
+					continue;
+				}
+				ret = false; // The input ends in the middle of a tag
+				break;
+			}
+			markup(lt, gt);
+			mPos = size_t(gt + 1 - mData);
+		}
+		resolvePendingJoints();
+
+		return ret;
+	}
+
+	// Keeps the unconsumed input and appends the next chunk of the file, growing the buffer only if a
+	// single piece of markup does not fit.  Returns false once there is nothing more to read.
+	bool refill(void)
+	{
+		bool ret = false;
+
+		if (!mEnd)
+		{
+			size_t keep = mSize - mPos;
+			if (keep && mPos)
+			{
+				memmove(&mBuffer[0], &mBuffer[mPos], keep);
+			}
+			if (keep == mBuffer.size())
+			{
+				mBuffer.resize(mBuffer.size() * 2);
+			}
+			size_t count = fread(&mBuffer[keep], 1, mBuffer.size() - keep, mFile);
+			mData = &mBuffer[0];
+			mSize = keep + count;
+			mPos = 0;
+			mStats.mBytesRead += count;
+			if (count == 0)
+			{
+				mEnd = true;
+			}
+			ret = count != 0;
+		}
+
+		return ret;
+	}
+
+	// Returns the closing '>' of the markup starting at 'lt'; null if it is not complete yet
+	const char *findMarkupEnd(const char *lt, const char *end) const
+	{
+		const char *ret = nullptr;
+
+		size_t available = size_t(end - lt);
+		if (available < 9 && !mEnd)
+		{
+			// Not enough to tell which kind of markup this is
+		}
+		else if (startsWith(lt, end, "<!--"))
+		{
+			ret = findTerminator(lt + 4, end, "-->");
+		}
+		else if (startsWith(lt, end, "<![CDATA["))
+		{
+			ret = findTerminator(lt + 9, end, "]]>");
+		}
+		else if (startsWith(lt, end, "<?"))
+		{
+			ret = findTerminator(lt + 2, end, "?>");
+		}
+		else
+		{
+			// A tag or declaration; '>' may appear inside quoted values and a DOCTYPE may have an internal subset
+			char quote = 0;
+			uint32_t depth = 0;
+			for (const char *scan = lt + 1; scan < end; scan++)
+			{
+				char c = *scan;
+				if (quote)
+				{
+					if (c == quote)
+					{
+						quote = 0;
+					}
+				}
+				else if (c == '"' || c == '\'')
+				{
+					quote = c;
+				}
+				else if (c == '[')
+				{
+					depth++;
+				}
+				else if (c == ']' && depth)
+				{
+					depth--;
+				}
+				else if (c == '>' && depth == 0)
+				{
+					ret = scan;
+					break;
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	static bool startsWith(const char *str, const char *end, const char *prefix)
+	{
+		size_t len = strlen(prefix);
+		return size_t(end - str) >= len && memcmp(str, prefix, len) == 0;
+	}
+
+	// Returns the last character of the terminator; null if it is not found
+	static const char *findTerminator(const char *scan, const char *end, const char *terminator)
+	{
+		const char *ret = nullptr;
+
+		size_t len = strlen(terminator);
+		while (size_t(end - scan) >= len)
+		{
+			const char *c = static_cast<const char *>(memchr(scan, terminator[0], size_t(end - scan) - len + 1));
+			if (!c)
+			{
+				break;
+			}
+			if (memcmp(c, terminator, len) == 0)
+			{
+				ret = c + len - 1;
+				break;
+			}
+			scan = c + 1;
+		}
+
+		return ret;
+	}
+
+	void text(const char *start, const char *end)
+	{
+		if (mCaptureText && start < end)
+		{
+			mText.append(start, end);
+		}
+	}
+
+	void markup(const char *lt, const char *gt)
+	{
+		if (lt[1] == '/')
+		{
+			endElement();
+		}
+		else if (lt[1] == '!')
+		{
+			if (startsWith(lt, gt, "<![CDATA["))
+			{
+				text(lt + 9, gt - 2);
+			}
+		}
+		else if (lt[1] != '?')
+		{
+			bool selfClosing = gt[-1] == '/';
+			const char *attributesEnd = selfClosing ? gt - 1 : gt;
+			StringRef name;
+			name.mData = lt + 1;
+			const char *scan = name.mData;
+			while (scan < attributesEnd && !isSpace(*scan))
+			{
+				scan++;
+			}
+			name.mLength = size_t(scan - name.mData);
+			mAttributes = scan;
+			mAttributesEnd = attributesEnd;
+			startElement(name);
+			if (selfClosing)
+			{
+				endElement();
+			}
+		}
+	}
+
+	static bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	// Finds an attribute of the current start tag
+	bool getAttribute(const char *attribute, StringRef &value) const
+	{
+		bool ret = false;
+
+		size_t len = strlen(attribute);
+		const char *scan = mAttributes;
+		const char *end = mAttributesEnd;
+		while (!ret && scan < end)
+		{
+			while (scan < end && isSpace(*scan))
+			{
+				scan++;
+			}
+			const char *attributeName = scan;
+			while (scan < end && *scan != '=' && !isSpace(*scan))
+			{
+				scan++;
+			}
+			size_t nameLength = size_t(scan - attributeName);
+			while (scan < end && (isSpace(*scan) || *scan == '='))
+			{
+				scan++;
+			}
+			if (scan >= end || (*scan != '"' && *scan != '\''))
+			{
+				break;
+			}
+			char quote = *scan++;
+			const char *valueStart = scan;
+			while (scan < end && *scan != quote)
+			{
+				scan++;
+			}
+			if (nameLength == len && memcmp(attributeName, attribute, len) == 0)
+			{
+				value.mData = valueStart;
+				value.mLength = size_t(scan - valueStart);
+				ret = true;
+			}
+			scan++;
+		}
+
+		return ret;
+	}
+
+	// Copies a name out of the input, replacing character and entity references
+	static void decode(const char *str, size_t length, std::string &out)
+	{
+		out.clear();
+		const char *end = str + length;
+		while (str < end)
+		{
+			const char *amp = static_cast<const char *>(memchr(str, '&', size_t(end - str)));
+			if (!amp)
+			{
+				out.append(str, end);
+				break;
+			}
+			out.append(str, amp);
+			const char *semi = static_cast<const char *>(memchr(amp, ';', size_t(end - amp)));
+			if (!semi)
+			{
+				out.append(amp, end);
+				break;
+			}
+			std::string entity(amp + 1, semi);
+			if (entity == "lt")
+			{
+				out.push_back('<');
+			}
+			else if (entity == "gt")
+			{
+				out.push_back('>');
+			}
+			else if (entity == "amp")
+			{
+				out.push_back('&');
+			}
+			else if (entity == "quot")
+			{
+				out.push_back('"');
+			}
+			else if (entity == "apos")
+			{
+				out.push_back('\'');
+			}
+			else if (entity.size() > 1 && entity[0] == '#')
+			{
+				unsigned long code = entity[1] == 'x' ? strtoul(entity.c_str() + 2, nullptr, 16) : strtoul(entity.c_str() + 1, nullptr, 10);
+				out.push_back(code < 128 ? char(code) : '?');
+			}
+			else
+			{
+				out.append(amp, semi + 1);
+			}
+			str = semi + 1;
+		}
+	}
+
+	static void trim(std::string &str)
+	{
+		size_t start = 0;
+		size_t end = str.size();
+		while (start < end && isSpace(str[start]))
+		{
+			start++;
+		}
+		while (end > start && isSpace(str[end - 1]))
+		{
+			end--;
+		}
+		str = str.substr(start, end - start);
+	}
+
+	void startElement(const StringRef &name)
+	{
+		Element e;
+		Element *parent = mStack.empty() ? nullptr : &mStack.back();
+		StringRef value;
+		if (name.equals("link"))
+		{
+			e.mKind = EK_LINK;
+			if (getAttribute("name", value))
+			{
+				decode(value.mData, value.mLength, mName);
+				addRigidBody(mName.c_str());
+			}
+		}
+		else if (name.equals("body"))
+		{
+			e.mKind = EK_BODY;
+			if (getAttribute("name", value))
+			{
+				decode(value.mData, value.mLength, mName);
+				if (mBuilder->addRigidBody(mName.c_str()))
+				{
+					e.mBody = mBuilder->getRigidBodyHandle(mName.c_str());
+				}
+				else
+				{
+					mStats.mDuplicateCount++;
+				}
+			}
+			if (e.mBody == INVALID_HANDLE)
+			{
+				// An unnamed body, or a second body with the same name which must not be merged with the first
+				e.mBody = mBuilder->addRigidBody();
+			}
+			mStats.mRigidBodyCount++;
+			if (parent && parent->mKind == EK_BODY)
+			{
+				// The joints of the parent body precede its child bodies
+				connectBody(*parent, nullptr);
+				e.mParentBody = parent->mBody;
+			}
+		}
+		else if (parent && parent->mKind == EK_BODY && (name.equals("joint") || name.equals("freejoint")))
+		{
+			if (name.equals("freejoint") || (getAttribute("type", value) && value.equals("free")))
+			{
+				parent->mConnected = true; // Not attached to its parent at all
+			}
+			else
+			{
+				if (getAttribute("name", value))
+				{
+					decode(value.mData, value.mLength, mName);
+				}
+				else
+				{
+					mName.clear();
+				}
+				connectBody(*parent, mName.c_str());
+			}
+		}
+		else if (name.equals("joint"))
+		{
+			e.mKind = EK_JOINT;
+			mJointName.clear();
+			mParentName.clear();
+			mChildName.clear();
+			mHasParent = false;
+			mHasChild = false;
+			if (getAttribute("name", value))
+			{
+				decode(value.mData, value.mLength, mJointName);
+			}
+		}
+		else if (parent && parent->mKind == EK_JOINT && (name.equals("parent") || name.equals("child")))
+		{
+			e.mKind = name.equals("parent") ? EK_PARENT : EK_CHILD;
+			std::string &target = e.mKind == EK_PARENT ? mParentName : mChildName;
+			if (getAttribute("link", value))
+			{
+				decode(value.mData, value.mLength, target);
+				(e.mKind == EK_PARENT ? mHasParent : mHasChild) = true;
+			}
+			else
+			{
+				// SDF gives the rigid body as the text of the element
+				mText.clear();
+				mCaptureText = true;
+			}
+		}
+		mStack.push_back(e);
+	}
+
+	void endElement(void)
+	{
+		if (!mStack.empty())
+		{
+			Element e = mStack.back();
+			mStack.pop_back();
+			switch (e.mKind)
+			{
+				case EK_PARENT:
+				case EK_CHILD:
+					if (mCaptureText)
+					{
+						mCaptureText = false;
+						std::string &target = e.mKind == EK_PARENT ? mParentName : mChildName;
+						decode(mText.c_str(), mText.size(), target);
+						trim(target);
+						(e.mKind == EK_PARENT ? mHasParent : mHasChild) = true;
+					}
+					break;
+				case EK_JOINT:
+					if (mHasParent && mHasChild)
+					{
+						addJoint(mJointName, mParentName, mChildName);
+					}
+					break;
+				case EK_BODY:
+					connectBody(e, nullptr);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	void addRigidBody(const char *name)
+	{
+		if (mBuilder->addRigidBody(name))
+		{
+			mStats.mRigidBodyCount++;
+		}
+		else
+		{
+			mStats.mDuplicateCount++;
+		}
+	}
+
+	// Joins an MJCF body to its parent body the first time; with no joint name it is welded by an unnamed joint
+	void connectBody(Element &e, const char *jointName)
+	{
+		if (!e.mConnected && e.mParentBody != INVALID_HANDLE && e.mBody != INVALID_HANDLE)
+		{
+			e.mConnected = true;
+			uint32_t joint = INVALID_HANDLE;
+			if (jointName && *jointName)
+			{
+				// By handle, since either body may be unnamed
+				joint = mBuilder->addJoint(jointName, e.mParentBody, e.mBody);
+			}
+			if (joint == INVALID_HANDLE)
+			{
+				// No joint name, or one which was already used
+				mBuilder->addJoint(e.mParentBody, e.mBody);
+			}
+			mStats.mJointCount++;
+		}
+	}
+
+	void addJoint(const std::string &name, const std::string &body0, const std::string &body1)
+	{
+		if (tryAddJoint(name, body0, body1))
+		{
+			mStats.mJointCount++;
+		}
+		else if (!name.empty() && mBuilder->getJointHandle(name.c_str()) != INVALID_HANDLE)
+		{
+			mStats.mDuplicateCount++;
+		}
+		else
+		{
+			PendingJoint p;
+			p.mName = name;
+			p.mBody0 = body0;
+			p.mBody1 = body1;
+			mPendingJoints.push_back(p);
+		}
+	}
+
+	bool tryAddJoint(const std::string &name, const std::string &body0, const std::string &body1)
+	{
+		bool ret = false;
+
+		if (name.empty())
+		{
+			uint32_t b0 = mBuilder->getRigidBodyHandle(body0.c_str());
+			uint32_t b1 = mBuilder->getRigidBodyHandle(body1.c_str());
+			ret = b0 != INVALID_HANDLE && b1 != INVALID_HANDLE && mBuilder->addJoint(b0, b1) != INVALID_HANDLE;
+		}
+		else
+		{
+			ret = mBuilder->addJoint(name.c_str(), body0.c_str(), body1.c_str());
+		}
+
+		return ret;
+	}
+
+	// Adds the joints which were read before their rigid bodies, in the order they were read
+	void resolvePendingJoints(void)
+	{
+		for (auto &i : mPendingJoints)
+		{
+			if (tryAddJoint(i.mName, i.mBody0, i.mBody1))
+			{
+				mStats.mJointCount++;
+			}
+			else if (!i.mName.empty() && mBuilder->getJointHandle(i.mName.c_str()) != INVALID_HANDLE)
+			{
+				mStats.mDuplicateCount++;
+			}
+			else
+			{
+				mStats.mUnresolvedJointCount++;
+			}
+		}
+		mPendingJoints.clear();
+	}
+
+	enum
+	{
+		CHUNK_SIZE = 256 * 1024
+	};
+
+	HierarchyBuilder		*mBuilder;
+	RobotDescriptionStats	mStats;
+	// Input
+	FILE					*mFile{ nullptr };
+	std::vector< char >		mBuffer;				// Chunk of the file being tokenized
+	const char				*mData{ nullptr };		// Input read so far which has not been discarded
+	size_t					mSize{ 0 };
+	size_t					mPos{ 0 };				// Next character to tokenize
+	bool					mEnd{ false };			// True once there is no more input to read
+	// Current start tag
+	const char				*mAttributes{ nullptr };
+	const char				*mAttributesEnd{ nullptr };
+	// Elements currently open
+	ElementVector			mStack;
+	std::string				mName;
+	std::string				mJointName;
+	std::string				mParentName;
+	std::string				mChildName;
+	bool					mHasParent{ false };
+	bool					mHasChild{ false };
+	std::string				mText;					// Text of an SDF parent or child element
+	bool					mCaptureText{ false };
+	PendingJointVector		mPendingJoints;
+};
+
+bool readRobotDescriptionFile(HierarchyBuilder *hb, const char *fileName, RobotDescriptionStats *stats)
+{
+	RobotDescriptionParser parser(hb);
+	bool ret = !(hb->getFlags() & HBF_BORROW_NAMES) && parser.parseFile(fileName);
+	if (stats)
+	{
+		*stats = parser.mStats;
+	}
+	return ret;
+}
+
+bool readRobotDescription(HierarchyBuilder *hb, const char *data, size_t size, RobotDescriptionStats *stats)
+{
+	RobotDescriptionParser parser(hb);
+	bool ret = !(hb->getFlags() & HBF_BORROW_NAMES) && parser.parseBuffer(data, size);
+	if (stats)
+	{
+		*stats = parser.mStats;
+	}
+	return ret;
+}
+
+} // end of namespace
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// **********************************************************************************************************
+// Streaming reader for robot description files which feeds the rigid bodies and joints straight into a
+// HierarchyBuilder.  URDF, SDF and MJCF are all recognized by their elements, so the format does not need
+// to be specified:
+//
+//   URDF : <link name="..."/>  and  <joint name="..."> <parent link="..."/> <child link="..."/> </joint>
+//   SDF  : <link name="..."/>  and  <joint name="..."> <parent>...</parent> <child>...</child> </joint>
+//   MJCF : nested <body name="...">; the first <joint> of a body connects it to its parent body, and a body
+//          without any joint is welded to its parent with an unnamed joint.  Additional joints on the same
+//          body are further degrees of freedom of the same connection and are not added again.
+//
+// The input is tokenized in place, SAX style, without building a DOM.  Files are read in fixed size chunks,
+// so memory use is bounded by the chunk size, the longest single tag and the depth of nesting, no matter how
+// large the file is.  Each name is decoded into a temporary copy, which the builder copies again when it
+// adds the name, and joints held back until the end keep copies of their names; none of these copies
+// outlive the read, so a builder created with HBF_BORROW_NAMES is rejected.
+//
+// An MJCF body whose name was already used is counted as a duplicate and added without a name, so that
+// its own child bodies stay attached to it.
+//
+// A joint may be defined before the rigid bodies it connects; such joints are held back and added once the
+// whole input has been read.  Joints which still refer to an unknown rigid body (for example 'world') are
+// skipped and counted.
+// **********************************************************************************************************
+
+namespace HIERARCHY_BUILDER
+{
+
+class HierarchyBuilder;
+
+// Counts reported by the robot description readers
+class RobotDescriptionStats
+{
+public:
+	uint64_t	mBytesRead{ 0 };
+	uint32_t	mRigidBodyCount{ 0 };			// Rigid bodies added to the builder
+	uint32_t	mJointCount{ 0 };				// Joints added to the builder
+	uint32_t	mDuplicateCount{ 0 };			// Rigid bodies or joints skipped because the name was already added
+	uint32_t	mUnresolvedJointCount{ 0 };		// Joints skipped because a rigid body they refer to was never defined
+};
+
+// Read a URDF, SDF or MJCF file into the builder.  Returns false if the file could not be opened or ends in
+// the middle of a tag; everything read up to that point has still been added.  Also returns false, without
+// reading anything, if the builder was created with HBF_BORROW_NAMES.
+bool readRobotDescriptionFile(HierarchyBuilder *hb,const char *fileName,RobotDescriptionStats *stats=nullptr);
+
+// Read a URDF, SDF or MJCF document which is already in memory.  The data does not need to be null terminated.
+// Returns false in the same cases as readRobotDescriptionFile.
+bool readRobotDescription(HierarchyBuilder *hb,const char *data,size_t size,RobotDescriptionStats *stats=nullptr);
+
+} // End of the HIERARCHY_BUILDER namespace
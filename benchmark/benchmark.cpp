@@ -0,0 +1,700 @@
+// **********************************************************************************************************
+// Benchmark for the HierarchyBuilder.
+//
+// Generates parameterized synthetic scenes and times each phase of using the builder separately:
+//
+//   ingest  : adding every named rigid body and joint
+//   build   : the call to build()
+//   query   : walking every hierarchy view, the disconnected rigid bodies and looking up every name
+//   reset   : the call to reset() on a fully built builder
+//   release : the call to release() on a fully built builder
+//
+// The retained and peak memory reported by getBuildStats() after the build are included as well.
+//
+// Scene types:
+//
+//   chain    : one long chain of rigid bodies
+//   star     : a single root rigid body with every other rigid body attached directly to it
+//   forest   : many random trees of varying size
+//   shuffled : a single large random tree with the joints added in random order
+//   robots   : many copies of the same small robot, named per robot like robot_00042/link_7
+//   loops    : random trees with a large number of extra loop closing joints
+//
+// Scene sizes are the number of joints, stepping by powers of ten from 10^min up to 10^max.
+// Results are written as CSV or JSON.
+//
+// Usage: hierarchybuilder_benchmark [options]
+//
+//   --scenes a,b,c   Scene types to run (default: all)
+//   --min N          Smallest scene is 10^N joints (default: 2)
+//   --max N          Largest scene is 10^N joints (default: 6, up to 7)
+//   --reps N         Repetitions per scene; the fastest time of each phase is reported (default: 3)
+//   --threads N      BuildOptions::mThreadCount used by build(); 0 for all hardware threads (default: 1)
+//   --root P         Root policy: first, center or degree (default: first)
+//   --share N        1 to set BuildOptions::mShareStructure (default: 0)
+//   --lazy N         1 to set BuildOptions::mLazy; build then only finds the components (default: 0)
+//   --names N        full, or compressed to create the builder with HBF_COMPRESS_NAMES (default: full)
+//   --seed N         Random seed used by the scene generators (default: 1)
+//   --format F       csv or json (default: csv)
+//   --output FILE    Write the results to this file instead of stdout
+// **********************************************************************************************************
+
+#include "../HierarchyBuilder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <utility>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+typedef std::vector< uint32_t > IndexVector;
+
+enum SceneType
+{
+	ST_CHAIN,
+	ST_STAR,
+	ST_FOREST,
+	ST_SHUFFLED,
+	ST_ROBOTS,
+	ST_LOOPS,
+	ST_COUNT
+};
+
+const char *gSceneNames[ST_COUNT] =
+{
+	"chain",
+	"star",
+	"forest",
+	"shuffled",
+	"robots",
+	"loops",
+};
+
+// Small deterministic random number generator so every platform produces the same scenes
+class Random
+{
+public:
+	Random(uint64_t seed) : mState(seed * 0x9E3779B97F4A7C15ULL + 1)
+	{
+	}
+
+	uint32_t next(void)
+	{
+		mState ^= mState << 13;
+		mState ^= mState >> 7;
+		mState ^= mState << 17;
+		return uint32_t(mState >> 32);
+	}
+
+	// Returns a value in [0,range)
+	uint32_t range(uint32_t range)
+	{
+		return uint32_t((uint64_t(next()) * range) >> 32);
+	}
+
+private:
+	uint64_t	mState;
+};
+
+// A generated scene.  All of the names live in one buffer so generating them is not part of any timing.
+class Scene
+{
+public:
+	void clear(void)
+	{
+		mBodyCount = 0;
+		mRobotBodies = 0;
+		mNames.clear();
+		mBodyNameOffsets.clear();
+		mJointNameOffsets.clear();
+		mBody0.clear();
+		mBody1.clear();
+		mBodyNames.clear();
+		mJointNames.clear();
+		mJointBody0.clear();
+		mJointBody1.clear();
+	}
+
+	uint32_t addBody(void)
+	{
+		uint32_t ret = mBodyCount++;
+		return ret;
+	}
+
+	void addJoint(uint32_t body0, uint32_t body1)
+	{
+		mBody0.push_back(body0);
+		mBody1.push_back(body1);
+	}
+
+	// Randomly permutes the order in which the joints are added
+	void shuffleJoints(Random &r)
+	{
+		for (uint32_t i = uint32_t(mBody0.size()); i > 1; i--)
+		{
+			uint32_t j = r.range(i);
+			std::swap(mBody0[i - 1], mBody0[j]);
+			std::swap(mBody1[i - 1], mBody1[j]);
+		}
+	}
+
+	// Builds the name strings and the pointer arrays handed to the builder
+	void finalize(void)
+	{
+		char scratch[64];
+		for (uint32_t i = 0; i < mBodyCount; i++)
+		{
+			mBodyNameOffsets.push_back(uint32_t(mNames.size()));
+			int len = mRobotBodies ? snprintf(scratch, sizeof(scratch), "robot_%05u/link_%u", i / mRobotBodies, i % mRobotBodies) :
+				snprintf(scratch, sizeof(scratch), "body_%u", i);
+			mNames.insert(mNames.end(), scratch, scratch + len + 1);
+		}
+		for (uint32_t i = 0; i < mBody0.size(); i++)
+		{
+			mJointNameOffsets.push_back(uint32_t(mNames.size()));
+			int len = mRobotBodies ? snprintf(scratch, sizeof(scratch), "robot_%05u/joint_%u", i / (mRobotBodies - 1), i % (mRobotBodies - 1)) :
+				snprintf(scratch, sizeof(scratch), "joint_%u", i);
+			mNames.insert(mNames.end(), scratch, scratch + len + 1);
+		}
+		const char *names = &mNames[0];
+		for (uint32_t i = 0; i < mBodyCount; i++)
+		{
+			mBodyNames.push_back(names + mBodyNameOffsets[i]);
+		}
+		for (uint32_t i = 0; i < mBody0.size(); i++)
+		{
+			mJointNames.push_back(names + mJointNameOffsets[i]);
+			mJointBody0.push_back(mBodyNames[mBody0[i]]);
+			mJointBody1.push_back(mBodyNames[mBody1[i]]);
+		}
+	}
+
+	uint32_t getJointCount(void) const
+	{
+		return uint32_t(mBody0.size());
+	}
+
+	uint32_t					mBodyCount{ 0 };
+	uint32_t					mRobotBodies{ 0 };	// Rigid bodies in each robot, for names per robot; zero for plain names
+	std::vector< char >			mNames;
+	IndexVector					mBodyNameOffsets;
+	IndexVector					mJointNameOffsets;
+	IndexVector					mBody0;
+	IndexVector					mBody1;
+	std::vector< const char * >	mBodyNames;
+	std::vector< const char * >	mJointNames;
+	std::vector< const char * >	mJointBody0;
+	std::vector< const char * >	mJointBody1;
+};
+
+// Adds a random tree with this many joints, each new rigid body attached to a random earlier one
+void addRandomTree(Scene &s, Random &r, uint32_t jointCount)
+{
+	uint32_t root = s.addBody();
+	for (uint32_t i = 0; i < jointCount; i++)
+	{
+		uint32_t parent = root + r.range(i + 1);
+		s.addJoint(parent, s.addBody());
+	}
+}
+
+void generateScene(Scene &s, SceneType type, uint32_t jointCount, Random &r)
+{
+	s.clear();
+	switch (type)
+	{
+		case ST_CHAIN:
+			{
+				uint32_t prev = s.addBody();
+				for (uint32_t i = 0; i < jointCount; i++)
+				{
+					uint32_t next = s.addBody();
+					s.addJoint(prev, next);
+					prev = next;
+				}
+			}
+			break;
+		case ST_STAR:
+			{
+				uint32_t root = s.addBody();
+				for (uint32_t i = 0; i < jointCount; i++)
+				{
+					s.addJoint(root, s.addBody());
+				}
+			}
+			break;
+		case ST_FOREST:
+			while (s.getJointCount() < jointCount)
+			{
+				uint32_t size = 1 + r.range(256);
+				if (size > jointCount - s.getJointCount())
+				{
+					size = jointCount - s.getJointCount();
+				}
+				addRandomTree(s, r, size);
+				// Sprinkle in a few rigid bodies which are not connected to anything
+				if (r.range(8) == 0)
+				{
+					s.addBody();
+				}
+			}
+			s.shuffleJoints(r);
+			break;
+		case ST_SHUFFLED:
+			addRandomTree(s, r, jointCount);
+			s.shuffleJoints(r);
+			break;
+		case ST_ROBOTS:
+			{
+				// One fixed 31 joint robot, similar in shape to the one in the demo, copied over and over
+				const uint32_t ROBOT_JOINTS = 31;
+				Random robotShape(12345);
+				s.mRobotBodies = ROBOT_JOINTS + 1;
+				uint32_t parents[ROBOT_JOINTS];
+				for (uint32_t i = 0; i < ROBOT_JOINTS; i++)
+				{
+					parents[i] = robotShape.range(i + 1);
+				}
+				while (s.getJointCount() < jointCount)
+				{
+					uint32_t base = s.addBody();
+					for (uint32_t i = 0; i < ROBOT_JOINTS && s.getJointCount() < jointCount; i++)
+					{
+						s.addJoint(base + parents[i], s.addBody());
+					}
+				}
+			}
+			break;
+		case ST_LOOPS:
+			// Random trees where roughly a third of all joints close a loop within their own tree
+			while (s.getJointCount() < jointCount)
+			{
+				uint32_t remaining = jointCount - s.getJointCount();
+				uint32_t size = 1 + r.range(512);
+				if (size > remaining)
+				{
+					size = remaining;
+				}
+				uint32_t base = s.mBodyCount;
+				addRandomTree(s, r, size);
+				uint32_t loops = (size + 1) / 2;
+				if (loops > remaining - size)
+				{
+					loops = remaining - size;
+				}
+				for (uint32_t i = 0; i < loops; i++)
+				{
+					s.addJoint(base + r.range(size + 1), base + r.range(size + 1));
+				}
+			}
+			s.shuffleJoints(r);
+			break;
+		default:
+			break;
+	}
+	s.finalize();
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration< double, std::milli >(Clock::now() - start).count();
+}
+
+enum Phase
+{
+	P_INGEST,
+	P_BUILD,
+	P_QUERY,
+	P_RESET,
+	P_RELEASE,
+	P_COUNT
+};
+
+const char *gPhaseNames[P_COUNT] =
+{
+	"ingest_ms",
+	"build_ms",
+	"query_ms",
+	"reset_ms",
+	"release_ms",
+};
+
+class Result
+{
+public:
+	SceneType	mType{ ST_CHAIN };
+	uint32_t	mRigidBodyCount{ 0 };
+	uint32_t	mJointCount{ 0 };
+	uint32_t	mHierarchyCount{ 0 };
+	uint32_t	mDisconnectedCount{ 0 };
+	uint32_t	mLoopJointCount{ 0 };
+	uint64_t	mChecksum{ 0 };
+	uint64_t	mRetainedBytes{ 0 };	// From getBuildStats(); zero if the statistics are compiled out
+	uint64_t	mPeakBytes{ 0 };
+	uint64_t	mNameBytes{ 0 };		// The part of mRetainedBytes holding the names
+	double		mTimes[P_COUNT];
+};
+
+void ingest(HIERARCHY_BUILDER::HierarchyBuilder *hb, const Scene &s)
+{
+	for (uint32_t i = 0; i < s.mBodyCount; i++)
+	{
+		hb->addRigidBody(s.mBodyNames[i]);
+	}
+	for (uint32_t i = 0; i < s.getJointCount(); i++)
+	{
+		hb->addJoint(s.mJointNames[i], s.mJointBody0[i], s.mJointBody1[i]);
+	}
+}
+
+// Touches every result the builder produces and folds it into a checksum so none of it can be skipped
+void query(HIERARCHY_BUILDER::HierarchyBuilder *hb, const Scene &s, Result &result)
+{
+	uint64_t checksum = 0;
+	uint32_t loops = 0;
+	uint32_t hcount = hb->getHierarchyCount();
+	for (uint32_t i = 0; i < hcount; i++)
+	{
+		HIERARCHY_BUILDER::HierarchyView view;
+		if (hb->getHierarchyView(i, view))
+		{
+			for (uint32_t n = 0; n < view.mNodeCount; n++)
+			{
+				checksum = checksum * 31 + view.mRigidBodies[n] + view.mJoints[n] + view.mChildOffsets[n];
+				loops += view.mLoopJoints[n] ? 1 : 0;
+			}
+		}
+	}
+	uint32_t dcount = hb->getDisconnectedRigidBodyCount();
+	for (uint32_t i = 0; i < dcount; i++)
+	{
+		checksum = checksum * 31 + hb->getDisconnectedRigidBodyIndex(i);
+	}
+	for (uint32_t i = 0; i < s.mBodyCount; i++)
+	{
+		checksum += hb->getRigidBodyHandle(s.mBodyNames[i]);
+	}
+	for (uint32_t i = 0; i < s.getJointCount(); i++)
+	{
+		checksum += hb->getJointHandle(s.mJointNames[i]);
+	}
+	result.mHierarchyCount = hcount;
+	result.mDisconnectedCount = dcount;
+	result.mLoopJointCount = loops;
+	result.mChecksum = checksum;
+}
+
+void runScene(const Scene &s, SceneType type, uint32_t reps, uint32_t flags, const HIERARCHY_BUILDER::BuildOptions &options, Result &result)
+{
+
+	result.mType = type;
+	result.mRigidBodyCount = s.mBodyCount;
+	result.mJointCount = s.getJointCount();
+	for (uint32_t p = 0; p < P_COUNT; p++)
+	{
+		result.mTimes[p] = 1e30;
+	}
+	for (uint32_t r = 0; r < reps; r++)
+	{
+		double times[P_COUNT];
+		HIERARCHY_BUILDER::HierarchyBuilder *hb = HIERARCHY_BUILDER::HierarchyBuilder::create(nullptr, flags);
+
+		Clock::time_point start = Clock::now();
+		ingest(hb, s);
+		times[P_INGEST] = elapsedMs(start);
+
+		start = Clock::now();
+		hb->build(options);
+		times[P_BUILD] = elapsedMs(start);
+
+		start = Clock::now();
+		query(hb, s, result);
+		times[P_QUERY] = elapsedMs(start);
+
+		HIERARCHY_BUILDER::BuildStats stats;
+		if (hb->getBuildStats(stats))
+		{
+			result.mRetainedBytes = stats.mRetainedBytes;
+			result.mPeakBytes = stats.mPeakBytes;
+			result.mNameBytes = stats.mNameBytes;
+		}
+
+		start = Clock::now();
+		hb->reset();
+		times[P_RESET] = elapsedMs(start);
+
+		// Populate the builder again so release() is measured on a fully built instance
+		ingest(hb, s);
+		hb->build(options);
+		start = Clock::now();
+		hb->release();
+		times[P_RELEASE] = elapsedMs(start);
+
+		for (uint32_t p = 0; p < P_COUNT; p++)
+		{
+			if (times[p] < result.mTimes[p])
+			{
+				result.mTimes[p] = times[p];
+			}
+		}
+	}
+}
+
+// Retained bytes for each joint of the scene
+double getBytesPerJoint(const Result &r)
+{
+	return r.mJointCount ? double(r.mRetainedBytes) / r.mJointCount : 0;
+}
+
+void writeCsv(FILE *fph, const std::vector< Result > &results)
+{
+	fprintf(fph, "scene,rigid_bodies,joints,hierarchies,disconnected,loop_joints");
+	for (uint32_t p = 0; p < P_COUNT; p++)
+	{
+		fprintf(fph, ",%s", gPhaseNames[p]);
+	}
+	fprintf(fph, ",retained_bytes,peak_bytes,name_bytes,bytes_per_joint,checksum\n");
+	for (auto &r : results)
+	{
+		fprintf(fph, "%s,%u,%u,%u,%u,%u", gSceneNames[r.mType], r.mRigidBodyCount, r.mJointCount, r.mHierarchyCount, r.mDisconnectedCount, r.mLoopJointCount);
+		for (uint32_t p = 0; p < P_COUNT; p++)
+		{
+			fprintf(fph, ",%.3f", r.mTimes[p]);
+		}
+		fprintf(fph, ",%llu,%llu,%llu,%.1f,%016llx\n", (unsigned long long)r.mRetainedBytes, (unsigned long long)r.mPeakBytes,
+			(unsigned long long)r.mNameBytes, getBytesPerJoint(r), (unsigned long long)r.mChecksum);
+	}
+}
+
+void writeJson(FILE *fph, const std::vector< Result > &results)
+{
+	fprintf(fph, "[\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result &r = results[i];
+		fprintf(fph, "  { \"scene\": \"%s\", \"rigid_bodies\": %u, \"joints\": %u, \"hierarchies\": %u, \"disconnected\": %u, \"loop_joints\": %u",
+			gSceneNames[r.mType], r.mRigidBodyCount, r.mJointCount, r.mHierarchyCount, r.mDisconnectedCount, r.mLoopJointCount);
+		for (uint32_t p = 0; p < P_COUNT; p++)
+		{
+			fprintf(fph, ", \"%s\": %.3f", gPhaseNames[p], r.mTimes[p]);
+		}
+		fprintf(fph, ", \"retained_bytes\": %llu, \"peak_bytes\": %llu", (unsigned long long)r.mRetainedBytes, (unsigned long long)r.mPeakBytes);
+		fprintf(fph, ", \"name_bytes\": %llu, \"bytes_per_joint\": %.1f", (unsigned long long)r.mNameBytes, getBytesPerJoint(r));
+		fprintf(fph, ", \"checksum\": \"%016llx\" }%s\n", (unsigned long long)r.mChecksum, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(fph, "]\n");
+}
+
+bool parseScenes(const char *list, bool *enabled)
+{
+	bool ret = true;
+
+	for (uint32_t i = 0; i < ST_COUNT; i++)
+	{
+		enabled[i] = false;
+	}
+	std::string names(list);
+	size_t start = 0;
+	while (start <= names.size())
+	{
+		size_t end = names.find(',', start);
+		if (end == std::string::npos)
+		{
+			end = names.size();
+		}
+		std::string name = names.substr(start, end - start);
+		bool found = false;
+		for (uint32_t i = 0; i < ST_COUNT; i++)
+		{
+			if (name == gSceneNames[i])
+			{
+				enabled[i] = true;
+				found = true;
+			}
+		}
+		if (!found)
+		{
+			fprintf(stderr, "Unknown scene type '%s'\n", name.c_str());
+			ret = false;
+		}
+		start = end + 1;
+	}
+
+	return ret;
+}
+
+void printUsage(void)
+{
+	fprintf(stderr, "Usage: hierarchybuilder_benchmark [--scenes chain,star,forest,shuffled,robots,loops] [--min N] [--max N]\n");
+	fprintf(stderr, "                                  [--reps N] [--threads N] [--root first|center|degree] [--share 0|1] [--lazy 0|1]\n");
+	fprintf(stderr, "                                  [--names full|compressed]\n");
+	fprintf(stderr, "                                  [--seed N] [--format csv|json] [--output FILE]\n");
+}
+
+}
+
+int main(int argc, const char **argv)
+{
+	bool enabled[ST_COUNT];
+	for (uint32_t i = 0; i < ST_COUNT; i++)
+	{
+		enabled[i] = true;
+	}
+	uint32_t minExponent = 2;
+	uint32_t maxExponent = 6;
+	uint32_t reps = 3;
+	HIERARCHY_BUILDER::BuildOptions options;
+	uint32_t flags = 0;
+	uint32_t seed = 1;
+	bool json = false;
+	const char *output = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		bool ok = value != nullptr;
+		if (ok && strcmp(arg, "--scenes") == 0)
+		{
+			ok = parseScenes(value, enabled);
+		}
+		else if (ok && strcmp(arg, "--min") == 0)
+		{
+			minExponent = uint32_t(atoi(value));
+		}
+		else if (ok && strcmp(arg, "--max") == 0)
+		{
+			maxExponent = uint32_t(atoi(value));
+		}
+		else if (ok && strcmp(arg, "--reps") == 0)
+		{
+			reps = uint32_t(atoi(value));
+		}
+		else if (ok && strcmp(arg, "--threads") == 0)
+		{
+			options.mThreadCount = uint32_t(atoi(value));
+		}
+		else if (ok && strcmp(arg, "--share") == 0)
+		{
+			options.mShareStructure = atoi(value) != 0;
+		}
+		else if (ok && strcmp(arg, "--lazy") == 0)
+		{
+			options.mLazy = atoi(value) != 0;
+		}
+		else if (ok && strcmp(arg, "--names") == 0)
+		{
+			if (strcmp(value, "compressed") == 0)
+			{
+				flags = HIERARCHY_BUILDER::HBF_COMPRESS_NAMES;
+			}
+			else
+			{
+				ok = strcmp(value, "full") == 0;
+			}
+		}
+		else if (ok && strcmp(arg, "--root") == 0)
+		{
+			if (strcmp(value, "first") == 0)
+			{
+				options.mRootPolicy = HIERARCHY_BUILDER::ROOT_FIRST_JOINT;
+			}
+			else if (strcmp(value, "center") == 0)
+			{
+				options.mRootPolicy = HIERARCHY_BUILDER::ROOT_TREE_CENTER;
+			}
+			else if (strcmp(value, "degree") == 0)
+			{
+				options.mRootPolicy = HIERARCHY_BUILDER::ROOT_MAX_DEGREE;
+			}
+			else
+			{
+				ok = false;
+			}
+		}
+		else if (ok && strcmp(arg, "--seed") == 0)
+		{
+			seed = uint32_t(atoi(value));
+		}
+		else if (ok && strcmp(arg, "--format") == 0)
+		{
+			json = strcmp(value, "json") == 0;
+			ok = json || strcmp(value, "csv") == 0;
+		}
+		else if (ok && strcmp(arg, "--output") == 0)
+		{
+			output = value;
+		}
+		else
+		{
+			ok = false;
+		}
+		if (!ok)
+		{
+			printUsage();
+			return 1;
+		}
+		i++;
+	}
+	if (maxExponent > 7)
+	{
+		maxExponent = 7;
+	}
+	if (reps == 0)
+	{
+		reps = 1;
+	}
+
+	std::vector< Result > results;
+	Scene scene;
+	for (uint32_t t = 0; t < ST_COUNT; t++)
+	{
+		if (!enabled[t])
+		{
+			continue;
+		}
+		uint32_t jointCount = 1;
+		for (uint32_t e = 0; e < minExponent; e++)
+		{
+			jointCount *= 10;
+		}
+		for (uint32_t e = minExponent; e <= maxExponent; e++)
+		{
+			Random r(seed);
+			generateScene(scene, SceneType(t), jointCount, r);
+			Result result;
+			runScene(scene, SceneType(t), reps, flags, options, result);
+			results.push_back(result);
+			fprintf(stderr, "%-8s %9u joints : build %10.3f ms\n", gSceneNames[t], jointCount, result.mTimes[P_BUILD]);
+			jointCount *= 10;
+		}
+	}
+
+	FILE *fph = output ? fopen(output, "wb") : stdout;
+	if (!fph)
+	{
+		fprintf(stderr, "Failed to open '%s' for writing\n", output);
+		return 1;
+	}
+	if (json)
+	{
+		writeJson(fph, results);
+	}
+	else
+	{
+		writeCsv(fph, results);
+	}
+	if (fph != stdout)
+	{
+		fclose(fph);
+	}
+
+	return 0;
+}
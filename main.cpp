@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
+#include <utility>
 
 // This is a small demonstration application that shows how to use the HierarchyBuilder
 // class to automatically derive hierarchies of connected rigid bodies and display the results
@@ -93,27 +95,35 @@ JointRef gJoints[]
 	{ "wrist_flex_joint", "forearm_roll_link", "wrist_flex_link" },
 };
 
-void showHierarchy(const HIERARCHY_BUILDER::HierarchyLink *link, uint32_t depth)
+void showHierarchy(const HIERARCHY_BUILDER::HierarchyLink *root)
 {
-	// Display the joints
-	uint32_t count = link->getChildCount();
-	for (uint32_t i = 0; i < count; i++)
+	// Traverse with an explicit stack rather than recursion so that very deep chains can be displayed
+	std::vector< std::pair< const HIERARCHY_BUILDER::HierarchyLink *, uint32_t > > stack;
+	stack.push_back(std::make_pair(root, 0u));
+	while (!stack.empty())
 	{
-		const char *body0;
-		const char *body1;
-		bool isLoopJoint;
-		const char *j = link->getJoint(i, body0, body1, isLoopJoint);
-		for (uint32_t k = 0; k < depth; k++)
+		const HIERARCHY_BUILDER::HierarchyLink *link = stack.back().first;
+		uint32_t depth = stack.back().second;
+		stack.pop_back();
+		// Display the joints
+		uint32_t count = link->getChildCount();
+		for (uint32_t i = 0; i < count; i++)
 		{
-			printf("    ");
+			const char *body0;
+			const char *body1;
+			bool isLoopJoint;
+			const char *j = link->getJoint(i, body0, body1, isLoopJoint);
+			for (uint32_t k = 0; k < depth; k++)
+			{
+				printf("    ");
+			}
+			printf("Joint(%s) : body0(%s)->body1(%s) : loop(%s)\r\n", j, body0, body1, isLoopJoint ? "true" : "false");
+		}
+		// Then display the hierarchy of each child node, first child first
+		for (uint32_t i = count; i > 0; i--)
+		{
+			stack.push_back(std::make_pair(link->getChild(i - 1), depth + 1));
 		}
-		printf("Joint(%s) : body0(%s)->body1(%s) : loop(%s)\r\n", j, body0, body1, isLoopJoint ? "true" : "false");
-	}
-	// Recursively traverse and display the hierarchy of each child node
-	for (uint32_t i = 0; i < count; i++)
-	{
-		const HIERARCHY_BUILDER::HierarchyLink *child = link->getChild(i);
-		showHierarchy(child, depth + 1);
 	}
 }
 
@@ -149,7 +159,7 @@ int main(int argc,const char **argv)
 			printf("Hierarchy[%d]\r\n", i);
 			printf("========================================================\r\n");
 			const HIERARCHY_BUILDER::HierarchyLink *link = hb->getHierarchyRoot(i);
-			showHierarchy(link, 0);
+			showHierarchy(link);
 			printf("========================================================\r\n");
 			printf("\r\n");
 		}
@@ -0,0 +1,139 @@
+// **********************************************************************************************************
+// Batch builds.  Every scene of a HierarchyBatch build has the same hierarchies, disconnected rigid bodies
+// and handles as the same scene built on its own by a HierarchyBuilder, for any thread count, and a batch
+// reused for a smaller set of scenes reports only the new results.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+
+// The scenes of one batch, stored the way BatchScenes expects
+class Scenes
+{
+public:
+	void add(uint32_t seed, uint32_t bodyCount)
+	{
+		HierarchyBuilder *hb = HierarchyBuilder::create();
+		addScene(hb, seed, bodyCount, false);
+		if (mJointOffsets.empty())
+		{
+			mJointOffsets.push_back(0);
+		}
+		for (uint32_t i = 0; i < hb->getJointCount(); i++)
+		{
+			uint32_t body0;
+			uint32_t body1;
+			hb->getJointBodies(i, body0, body1);
+			mBody0.push_back(body0);
+			mBody1.push_back(body1);
+		}
+		if (seed % 5 == 0)
+		{
+			// Refers to a rigid body outside the scene, so it is skipped
+			mBody0.push_back(0);
+			mBody1.push_back(bodyCount);
+		}
+		mBodyCounts.push_back(bodyCount);
+		mJointOffsets.push_back(uint32_t(mBody0.size()));
+		hb->release();
+	}
+
+	BatchScenes get(void) const
+	{
+		BatchScenes ret;
+		ret.mSceneCount = uint32_t(mBodyCounts.size());
+		ret.mBodyCounts = mBodyCounts.data();
+		ret.mJointOffsets = mJointOffsets.data();
+		ret.mJointBody0 = mBody0.data();
+		ret.mJointBody1 = mBody1.data();
+		return ret;
+	}
+
+	IndexVector	mBodyCounts;
+	IndexVector	mJointOffsets;
+	IndexVector	mBody0;
+	IndexVector	mBody1;
+};
+
+// Builds every scene on its own and compares it with the batch
+void compareScenes(const Scenes &scenes, HierarchyBatch *batch, const BuildOptions &options)
+{
+	CHECK(batch->getSceneCount() == scenes.mBodyCounts.size());
+	for (uint32_t s = 0; s < uint32_t(scenes.mBodyCounts.size()); s++)
+	{
+		HierarchyBuilder *hb = HierarchyBuilder::create();
+		for (uint32_t i = 0; i < scenes.mBodyCounts[s]; i++)
+		{
+			hb->addRigidBody();
+		}
+		for (uint32_t i = scenes.mJointOffsets[s]; i < scenes.mJointOffsets[s + 1]; i++)
+		{
+			hb->addJoint(scenes.mBody0[i], scenes.mBody1[i]);
+		}
+		hb->build(options);
+		CHECK(batch->getHierarchyCount(s) == hb->getHierarchyCount());
+		for (uint32_t i = 0; i < hb->getHierarchyCount(); i++)
+		{
+			HierarchyView a;
+			HierarchyView b;
+			hb->getHierarchyView(i, a);
+			if (CHECK(batch->getHierarchyView(s, i, b)) && CHECK(a.mNodeCount == b.mNodeCount))
+			{
+				CHECK(memcmp(a.mRigidBodies, b.mRigidBodies, sizeof(uint32_t) * a.mNodeCount) == 0);
+				CHECK(memcmp(a.mJoints, b.mJoints, sizeof(uint32_t) * a.mNodeCount) == 0);
+				CHECK(memcmp(a.mLoopJoints, b.mLoopJoints, a.mNodeCount) == 0);
+				CHECK(memcmp(a.mChildOffsets, b.mChildOffsets, sizeof(uint32_t) * (a.mNodeCount + 1)) == 0);
+			}
+		}
+		HierarchyView unused;
+		CHECK(!batch->getHierarchyView(s, hb->getHierarchyCount(), unused));
+		CHECK(batch->getDisconnectedRigidBodyCount(s) == hb->getDisconnectedRigidBodyCount());
+		for (uint32_t i = 0; i < hb->getDisconnectedRigidBodyCount(); i++)
+		{
+			CHECK(batch->getDisconnectedRigidBodyIndex(s, i) == hb->getDisconnectedRigidBodyIndex(i));
+		}
+		CHECK(batch->getDisconnectedRigidBodyIndex(s, hb->getDisconnectedRigidBodyCount()) == INVALID_HANDLE);
+		hb->release();
+	}
+	CHECK(batch->getHierarchyCount(uint32_t(scenes.mBodyCounts.size())) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+	Scenes large;
+	Scenes small;
+	Random random(7);
+	for (uint32_t s = 0; s < 300; s++)
+	{
+		// Includes empty scenes and scenes without joints
+		large.add(s + 1, random.next(5) ? random.next(200) : random.next(2));
+	}
+	for (uint32_t s = 0; s < 20; s++)
+	{
+		small.add(s + 1000, 10 + random.next(50));
+	}
+	HierarchyBatch *batch = HierarchyBatch::create();
+	for (uint32_t threads = 1; threads <= 4; threads++)
+	{
+		BuildOptions options;
+		options.mThreadCount = threads;
+		options.mRootPolicy = RootPolicy(threads % (ROOT_MAX_DEGREE + 1));
+		options.mShareStructure = (threads & 1) == 0;
+		BatchScenes scenes = large.get();
+		uint32_t total = batch->build(scenes, options);
+		compareScenes(large, batch, options);
+		uint32_t expected = 0;
+		for (uint32_t s = 0; s < scenes.mSceneCount; s++)
+		{
+			expected += batch->getHierarchyCount(s);
+		}
+		CHECK(total == expected);
+		// A smaller build replaces the results of the larger one
+		scenes = small.get();
+		batch->build(scenes, options);
+		compareScenes(small, batch, options);
+	}
+	batch->release();
+	return finishTest("batch");
+}
@@ -0,0 +1,93 @@
+// **********************************************************************************************************
+// Result caches.  A result restored from a MemoryHierarchyCache or a DirectoryHierarchyCache matches a fresh
+// build of the same inputs, and accepts incremental updates like a built one.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+
+// Passes every call on to another cache and remembers the keys stored, so their files can be removed
+class RecordingCache : public HierarchyCache
+{
+public:
+	RecordingCache(HierarchyCache *cache) : mCache(cache)
+	{
+	}
+
+	virtual bool find(const HierarchyKey &key, const void *&data, size_t &size) override final
+	{
+		return mCache->find(key, data, size);
+	}
+
+	virtual void store(const HierarchyKey &key, const void *data, size_t size) override final
+	{
+		mKeys.push_back(key);
+		mCache->store(key, data, size);
+	}
+
+	HierarchyCache					*mCache;
+	std::vector< HierarchyKey >		mKeys;
+};
+
+// A result restored from the cache matches a fresh build of the same inputs
+void checkCache(HierarchyCache *cache)
+{
+	for (uint32_t seed = 1; seed <= 8; seed++)
+	{
+		BuildOptions options;
+		options.mCache = cache;
+		options.mDepthFirstView = true;
+		options.mRootPolicy = RootPolicy(seed % 3);
+		options.mShareStructure = (seed & 1) != 0;
+		HierarchyBuilder *first = HierarchyBuilder::create();
+		HierarchyBuilder *second = HierarchyBuilder::create();
+		HierarchyBuilder *fresh = HierarchyBuilder::create();
+		addScene(first, seed, 300, false);
+		addScene(second, seed, 300, false);
+		addScene(fresh, seed, 300, false);
+		BuildOptions plain = options;
+		plain.mCache = nullptr;
+		first->build(options);
+		second->build(options);
+		fresh->build(plain);
+		BuildStats stats;
+		if (second->getBuildStats(stats))
+		{
+			CHECK(stats.mCacheHit);
+		}
+		CHECK(sameHierarchies(second, fresh));
+		CHECK(sameDepthFirstViews(second, fresh));
+		// A restored result accepts incremental updates like a built one
+		second->removeJoint(5);
+		fresh->removeJoint(5);
+		second->addJoint(1, 2);
+		fresh->addJoint(1, 2);
+		CHECK(sameHierarchies(second, fresh));
+		CHECK(sameDepthFirstViews(second, fresh));
+		first->release();
+		second->release();
+		fresh->release();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::string directory = argc > 1 ? argv[1] : ".";
+	MemoryHierarchyCache *memory = MemoryHierarchyCache::create(16 << 20);
+	checkCache(memory);
+	memory->release();
+	// The directory cache writes each result to a temporary file first; every one must be renamed into place
+	DirectoryHierarchyCache *files = DirectoryHierarchyCache::create(directory.c_str());
+	if (CHECK(files != nullptr))
+	{
+		RecordingCache recording(files);
+		checkCache(&recording);
+		files->release();
+		for (auto &i : recording.mKeys)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "/%016llx%016llx.hbr", (unsigned long long)i.mHigh, (unsigned long long)i.mLow);
+			CHECK(remove((directory + name).c_str()) == 0);
+		}
+	}
+	return finishTest("cache");
+}
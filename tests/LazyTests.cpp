@@ -0,0 +1,83 @@
+// **********************************************************************************************************
+// Lazy builds.  A lazy build matches an eager build once every hierarchy has been looked at, whether they
+// are looked at from one thread or from several at once, and reports the same statistics.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+#include <thread>
+
+// Each hierarchy is built the first time it is looked at
+void checkLazy(void)
+{
+	for (uint32_t seed = 1; seed <= 8; seed++)
+	{
+		BuildOptions options;
+		options.mDepthFirstView = true;
+		options.mRootPolicy = RootPolicy(seed % 3);
+		BuildOptions lazy = options;
+		lazy.mLazy = true;
+		HierarchyBuilder *eager = HierarchyBuilder::create();
+		HierarchyBuilder *deferred = HierarchyBuilder::create();
+		addScene(eager, seed, 300, false);
+		addScene(deferred, seed, 300, false);
+		eager->build(options);
+		deferred->build(lazy);
+		CHECK(sameHierarchies(deferred, eager));
+		CHECK(sameDepthFirstViews(deferred, eager));
+		BuildStats a;
+		BuildStats b;
+		if (eager->getBuildStats(a) && deferred->getBuildStats(b))
+		{
+			CHECK(b.mLazyHierarchyCount == deferred->getHierarchyCount());
+			CHECK(a.mLoopJointCount == b.mLoopJointCount);
+		}
+		eager->release();
+		deferred->release();
+	}
+}
+
+// Several threads look at every hierarchy at once, each starting at a different one
+void checkThreads(void)
+{
+	BuildOptions options;
+	options.mDepthFirstView = true;
+	BuildOptions lazy = options;
+	lazy.mLazy = true;
+	HierarchyBuilder *eager = HierarchyBuilder::create();
+	HierarchyBuilder *deferred = HierarchyBuilder::create();
+	addScene(eager, 9, 3000, false);
+	addScene(deferred, 9, 3000, false);
+	eager->build(options);
+	deferred->build(lazy);
+	const uint32_t threadCount = 8;
+	uint32_t count = deferred->getHierarchyCount();
+	std::vector< std::thread > threads;
+	for (uint32_t t = 0; t < threadCount; t++)
+	{
+		threads.push_back(std::thread([deferred, count, t]()
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				HierarchyView view;
+				deferred->getHierarchyView((i + t * 5) % count, view);
+			}
+		}));
+	}
+	for (auto &i : threads)
+	{
+		i.join();
+	}
+	CHECK(sameHierarchies(deferred, eager));
+	CHECK(sameDepthFirstViews(deferred, eager));
+	eager->release();
+	deferred->release();
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+	checkLazy();
+	checkThreads();
+	return finishTest("lazy");
+}
@@ -0,0 +1,111 @@
+// **********************************************************************************************************
+// Loop joint flags.  Walking a hierarchy from its root and skipping the joints flagged as loop joints must
+// reach every rigid body of the hierarchy exactly once, and the flagged joints must be exactly the loop
+// joints listed by the depth first view.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+
+// A small random tree, shuffled and with random joint directions, plus a few joints closing loops
+void addLoopScene(HierarchyBuilder *hb, Random &random)
+{
+	uint32_t bodyCount = 3 + random.next(20);
+	std::vector< std::pair< uint32_t, uint32_t > > joints;
+	for (uint32_t i = 1; i < bodyCount; i++)
+	{
+		uint32_t parent = random.next(i);
+		joints.push_back(random.next(2) ? std::make_pair(parent, i) : std::make_pair(i, parent));
+	}
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		joints.push_back(std::make_pair(random.next(bodyCount), random.next(bodyCount)));
+	}
+	for (size_t i = joints.size(); i > 1; i--)
+	{
+		std::swap(joints[i - 1], joints[random.next(uint32_t(i))]);
+	}
+	for (uint32_t i = 0; i < bodyCount; i++)
+	{
+		hb->addRigidBody();
+	}
+	for (auto &i : joints)
+	{
+		hb->addJoint(i.first, i.second);
+	}
+}
+
+void checkLoopFlags(HierarchyBuilder *hb)
+{
+	for (uint32_t i = 0; i < hb->getHierarchyCount(); i++)
+	{
+		HierarchyView view;
+		DepthFirstView depthFirst;
+		hb->getHierarchyView(i, view);
+		hb->getDepthFirstView(i, depthFirst);
+		IndexVector reached(hb->getRigidBodyCount(), 0);
+		IndexVector present(hb->getRigidBodyCount(), 0);
+		IndexVector loopJoints;
+		IndexVector stack;
+		stack.push_back(0);
+		while (!stack.empty())
+		{
+			uint32_t node = stack.back();
+			stack.pop_back();
+			reached[view.mRigidBodies[node]]++;
+			for (uint32_t k = view.mChildOffsets[node]; k < view.mChildOffsets[node + 1]; k++)
+			{
+				if (view.mLoopJoints[k])
+				{
+					loopJoints.push_back(view.mJoints[k]);
+				}
+				else
+				{
+					stack.push_back(k);
+				}
+			}
+		}
+		uint32_t bodyCount = 0;
+		for (uint32_t k = 0; k < view.mNodeCount; k++)
+		{
+			if (!present[view.mRigidBodies[k]]++)
+			{
+				bodyCount++;
+				CHECK(reached[view.mRigidBodies[k]] == 1);
+			}
+		}
+		CHECK(bodyCount == depthFirst.mBodyCount);
+		std::vector< uint32_t > listed(depthFirst.mLoopJoints, depthFirst.mLoopJoints + depthFirst.mLoopJointCount);
+		std::sort(loopJoints.begin(), loopJoints.end());
+		std::sort(listed.begin(), listed.end());
+		CHECK(loopJoints == listed);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+	Random random(1);
+	for (uint32_t scene = 0; scene < 2000; scene++)
+	{
+		// Every root policy flags the loop joints the same way
+		IndexVector roots;
+		roots.push_back(random.next(3));
+		roots.push_back(random.next(3));
+		BuildOptions options;
+		options.mDepthFirstView = true;
+		options.mRootPolicy = RootPolicy(scene % (ROOT_MAX_DEGREE + 1));
+		options.mRootBodies = roots.data();
+		options.mRootBodyCount = uint32_t(roots.size());
+		HierarchyBuilder *hb = HierarchyBuilder::create();
+		addLoopScene(hb, random);
+		hb->build(options);
+		checkLoopFlags(hb);
+		// The same must hold for the hierarchies rebuilt by an incremental update
+		hb->addJoint(random.next(hb->getRigidBodyCount()), random.next(hb->getRigidBodyCount()));
+		hb->removeJoint(random.next(hb->getJointCount()));
+		checkLoopFlags(hb);
+		hb->release();
+	}
+	return finishTest("loops");
+}
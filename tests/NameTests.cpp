@@ -0,0 +1,89 @@
+// **********************************************************************************************************
+// Front coded names.  HBF_COMPRESS_NAMES returns and looks up exactly the names which were added, in less
+// memory, and a returned name stays valid for as long as the HBF_COMPRESS_NAMES documentation promises.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+
+void checkNames(void)
+{
+	HierarchyBuilder *full = HierarchyBuilder::create();
+	HierarchyBuilder *compressed = HierarchyBuilder::create(nullptr, HBF_COMPRESS_NAMES);
+	addScene(full, 2, 2000, true);
+	addScene(compressed, 2, 2000, true);
+	full->build();
+	compressed->build();
+	CHECK(sameHierarchies(compressed, full));
+	CHECK(compressed->getRigidBodyCount() == full->getRigidBodyCount());
+	for (uint32_t i = 0; i < full->getRigidBodyCount(); i++)
+	{
+		std::string name = full->getRigidBody(i);
+		CHECK(name == compressed->getRigidBody(i));
+		CHECK(compressed->getRigidBodyHandle(name.c_str()) == i);
+	}
+	for (uint32_t i = 0; i < full->getJointCount(); i++)
+	{
+		const char *body0;
+		const char *body1;
+		std::string name = full->getJoint(i, body0, body1);
+		std::string names = name + " " + body0 + " " + body1;
+		const char *name0 = compressed->getJoint(i, body0, body1);
+		CHECK(names == std::string(name0) + " " + body0 + " " + body1);
+		CHECK(compressed->getJointHandle(name.c_str()) == i);
+	}
+	CHECK(compressed->getRigidBodyHandle("robot_00000/link_") == INVALID_HANDLE);
+	// A removed name reads as null and may be added again
+	compressed->removeRigidBody(11);
+	CHECK(compressed->getRigidBody(11) == nullptr);
+	CHECK(compressed->getRigidBodyHandle(full->getRigidBody(11)) == INVALID_HANDLE);
+	CHECK(compressed->addRigidBody(full->getRigidBody(11)));
+	CHECK(compressed->getRigidBodyHandle(full->getRigidBody(11)) == compressed->getRigidBodyCount() - 1);
+	BuildStats a;
+	BuildStats b;
+	if (full->getBuildStats(a) && compressed->getBuildStats(b))
+	{
+		CHECK(b.mNameBytes < a.mNameBytes);
+	}
+	full->release();
+	compressed->release();
+}
+
+// A returned name stays valid while seven more are returned, and while names are looked up, added and saved
+void checkLifetime(const std::string &directory)
+{
+	HierarchyBuilder *hb = HierarchyBuilder::create(nullptr, HBF_COMPRESS_NAMES);
+	addScene(hb, 3, 200, true);
+	hb->build();
+	std::vector< const char * > names;
+	std::vector< std::string > copies;
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		names.push_back(hb->getRigidBody(i * 3));
+		copies.push_back(names.back());
+	}
+	for (uint32_t i = 0; i < 100; i++)
+	{
+		hb->getRigidBodyHandle(copies[i % 8].c_str());
+		hb->getJointHandle("robot_00000/joint_1");
+		char name[64];
+		snprintf(name, sizeof(name), "robot_00000/extra_%u", i);
+		hb->addRigidBody(name);
+		hb->addJoint(name, copies[i % 8].c_str(), name);
+	}
+	std::string fileName = directory + "/tests_names.hbs";
+	CHECK(hb->save(fileName.c_str()));
+	remove(fileName.c_str());
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		CHECK(copies[i] == names[i]);
+	}
+	hb->release();
+}
+
+int main(int argc, char **argv)
+{
+	std::string directory = argc > 1 ? argv[1] : ".";
+	checkNames();
+	checkLifetime(directory);
+	return finishTest("names");
+}
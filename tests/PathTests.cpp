@@ -0,0 +1,120 @@
+// **********************************************************************************************************
+// Path queries.  isAncestor, getLowestCommonAncestor and getJointPath match a walk up the depth first parents,
+// with and without mPathQueries, for every root policy and after incremental updates.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+
+// Compares every query with walks up the depth first parents of each body
+void checkPathQueries(HierarchyBuilder *hb, bool pathQueries, uint32_t seed)
+{
+	uint32_t bodyCount = hb->getRigidBodyCount();
+	IndexVector hierarchies(bodyCount, INVALID_HANDLE);
+	IndexVector parents(bodyCount, INVALID_HANDLE);
+	IndexVector parentJoints(bodyCount, INVALID_HANDLE);
+	for (uint32_t i = 0; i < hb->getHierarchyCount(); i++)
+	{
+		DepthFirstView view;
+		if (CHECK(hb->getDepthFirstView(i, view)))
+		{
+			for (uint32_t k = 0; k < view.mBodyCount; k++)
+			{
+				uint32_t body = view.mRigidBodies[k];
+				hierarchies[body] = i;
+				parents[body] = k ? view.mRigidBodies[view.mParents[k]] : INVALID_HANDLE;
+				parentJoints[body] = view.mJoints[k];
+			}
+		}
+	}
+	Random random(seed);
+	IndexVector path(bodyCount);
+	for (uint32_t q = 0; q < 2000; q++)
+	{
+		uint32_t body0 = random.next(bodyCount + 1);
+		uint32_t body1 = random.next(bodyCount + 1);
+		bool connected = body0 < bodyCount && body1 < bodyCount && hierarchies[body0] != INVALID_HANDLE && hierarchies[body0] == hierarchies[body1];
+		IndexVector up0;
+		IndexVector up1;
+		for (uint32_t i = connected ? body0 : INVALID_HANDLE; i != INVALID_HANDLE; i = parents[i])
+		{
+			up0.push_back(i);
+		}
+		for (uint32_t i = connected ? body1 : INVALID_HANDLE; i != INVALID_HANDLE; i = parents[i])
+		{
+			up1.push_back(i);
+		}
+		bool ancestor = false;
+		for (size_t i = 1; i < up1.size(); i++)
+		{
+			ancestor = ancestor || up1[i] == body0;
+		}
+		CHECK(hb->isAncestor(body0, body1) == ancestor);
+		// Both walks end at the root; drop the shared part above the common ancestor
+		while (up0.size() > 1 && up1.size() > 1 && up0[up0.size() - 2] == up1[up1.size() - 2])
+		{
+			up0.pop_back();
+			up1.pop_back();
+		}
+		uint32_t common = connected ? up0.back() : INVALID_HANDLE;
+		IndexVector expected;
+		for (size_t i = 0; i + 1 < up0.size(); i++)
+		{
+			expected.push_back(parentJoints[up0[i]]);
+		}
+		for (size_t i = up1.size(); i > 1; i--)
+		{
+			expected.push_back(parentJoints[up1[i - 2]]);
+		}
+		uint32_t count = hb->getJointPath(body0, body1, path.data(), bodyCount);
+		if (pathQueries && connected)
+		{
+			CHECK(hb->getLowestCommonAncestor(body0, body1) == common);
+			CHECK(count == expected.size() && (count == 0 || memcmp(path.data(), expected.data(), sizeof(uint32_t) * count) == 0));
+		}
+		else
+		{
+			CHECK(hb->getLowestCommonAncestor(body0, body1) == INVALID_HANDLE);
+			CHECK(count == INVALID_HANDLE);
+		}
+	}
+}
+
+void checkPaths(void)
+{
+	for (uint32_t seed = 1; seed <= 8; seed++)
+	{
+		BuildOptions options;
+		options.mPathQueries = seed != 4;
+		options.mDepthFirstView = true;
+		options.mRootPolicy = RootPolicy(seed % (ROOT_MAX_DEGREE + 1));
+		options.mShareStructure = (seed & 1) != 0;
+		options.mLazy = seed == 5;
+		HierarchyBuilder *hb = HierarchyBuilder::create();
+		addScene(hb, seed, 500 + seed * 10, false);
+		hb->build(options);
+		checkPathQueries(hb, options.mPathQueries, seed);
+		// The tables follow incremental updates
+		Random random(seed);
+		for (uint32_t i = 0; i < 40; i++)
+		{
+			if (random.next(2))
+			{
+				hb->addJoint(random.next(hb->getRigidBodyCount()), random.next(hb->getRigidBodyCount()));
+			}
+			else
+			{
+				hb->removeJoint(random.next(hb->getJointCount()));
+			}
+		}
+		checkPathQueries(hb, options.mPathQueries, seed + 100);
+		hb->release();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+	checkPaths();
+	return finishTest("paths");
+}
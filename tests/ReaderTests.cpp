@@ -0,0 +1,208 @@
+// **********************************************************************************************************
+// Robot description reader.  Small URDF, SDF and MJCF documents must add exactly the rigid bodies and joints
+// they describe, whether read from memory or from a file whose markup straddles the boundary between two
+// chunks, and the counts reported in RobotDescriptionStats must match.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+#include "../RobotDescriptionReader.h"
+
+bool readText(HierarchyBuilder *hb, const char *text, RobotDescriptionStats &stats)
+{
+	return readRobotDescription(hb, text, strlen(text), &stats);
+}
+
+// True if the named joint exists and connects the two named rigid bodies in this order
+bool hasJoint(HierarchyBuilder *hb, const char *name, const char *body0, const char *body1)
+{
+	bool ret = false;
+
+	uint32_t joint = hb->getJointHandle(name);
+	uint32_t b0;
+	uint32_t b1;
+	if (joint != INVALID_HANDLE && hb->getJointBodies(joint, b0, b1))
+	{
+		ret = b0 == hb->getRigidBodyHandle(body0) && b1 == hb->getRigidBodyHandle(body1);
+	}
+
+	return ret;
+}
+
+void checkUrdf(void)
+{
+	// The joints come first, one refers to 'world' which is never defined, and one name is used twice
+	const char *urdf =
+		"<?xml version=\"1.0\"?>\n"
+		"<!-- <link name=\"commented\"/> -->\n"
+		"<robot name=\"arm\">\n"
+		"  <joint name=\"fixed_to_world\" type=\"fixed\"><parent link=\"world\"/><child link=\"base\"/></joint>\n"
+		"  <joint name=\"shoulder\" type=\"revolute\">\n"
+		"    <origin xyz=\"0 0 1\"/><parent link=\"base\"/><child link=\"upper&amp;arm\"/>\n"
+		"  </joint>\n"
+		"  <link name=\"base\"><visual><geometry><box size=\"1 1 1\"/></geometry></visual></link>\n"
+		"  <link name=\"upper&amp;arm\"/>\n"
+		"  <link name=\"hand\"/>\n"
+		"  <link name=\"hand\"/>\n"
+		"  <joint name=\"wrist\" type=\"revolute\"><parent link=\"upper&amp;arm\"/><child link=\"hand\"/></joint>\n"
+		"  <joint name=\"wrist\" type=\"revolute\"><parent link=\"base\"/><child link=\"hand\"/></joint>\n"
+		"</robot>\n";
+	HierarchyBuilder *hb = HierarchyBuilder::create();
+	RobotDescriptionStats stats;
+	CHECK(readText(hb, urdf, stats));
+	CHECK(hb->getRigidBodyCount() == 3);
+	CHECK(hb->getRigidBodyHandle("commented") == INVALID_HANDLE);
+	CHECK(hb->getJointCount() == 2);
+	CHECK(hasJoint(hb, "shoulder", "base", "upper&arm"));
+	CHECK(hasJoint(hb, "wrist", "upper&arm", "hand"));
+	CHECK(hb->getJointHandle("fixed_to_world") == INVALID_HANDLE);
+	CHECK(stats.mRigidBodyCount == 3);
+	CHECK(stats.mJointCount == 2);
+	CHECK(stats.mDuplicateCount == 2);
+	CHECK(stats.mUnresolvedJointCount == 1);
+	CHECK(stats.mBytesRead == strlen(urdf));
+	hb->release();
+}
+
+void checkSdf(void)
+{
+	// SDF gives the rigid bodies of a joint as text, with surrounding white space
+	const char *sdf =
+		"<sdf version=\"1.7\"><model name=\"cart\">\n"
+		"  <link name=\"chassis\"/>\n"
+		"  <joint name=\"left\" type=\"revolute\"><parent> chassis </parent><child>\n\twheel_l\n</child></joint>\n"
+		"  <joint name=\"right\" type=\"revolute\"><parent>chassis</parent><child><![CDATA[wheel_r]]></child></joint>\n"
+		"  <joint name=\"anchor\" type=\"fixed\"><parent>world</parent><child>chassis</child></joint>\n"
+		"  <link name=\"wheel_l\"/><link name=\"wheel_r\"/>\n"
+		"</model></sdf>\n";
+	HierarchyBuilder *hb = HierarchyBuilder::create();
+	RobotDescriptionStats stats;
+	CHECK(readText(hb, sdf, stats));
+	CHECK(hb->getRigidBodyCount() == 3);
+	CHECK(hb->getJointCount() == 2);
+	CHECK(hasJoint(hb, "left", "chassis", "wheel_l"));
+	CHECK(hasJoint(hb, "right", "chassis", "wheel_r"));
+	CHECK(stats.mJointCount == 2);
+	CHECK(stats.mUnresolvedJointCount == 1);
+	hb->release();
+}
+
+void checkMjcf(void)
+{
+	// An unnamed body holding a named joint, a body welded to its parent, a free body, extra degrees of
+	// freedom on one body and a body name used twice
+	const char *mjcf =
+		"<mujoco model=\"walker\"><worldbody>\n"
+		"  <body name=\"torso\"><freejoint/>\n"
+		"    <body><joint name=\"hip\" type=\"hinge\"/>\n"
+		"      <body name=\"shin\"><joint name=\"knee\"/><joint name=\"knee_twist\"/>\n"
+		"        <body name=\"foot\"/>\n"
+		"      </body>\n"
+		"    </body>\n"
+		"    <body name=\"shin\"><joint name=\"other_knee\"/></body>\n"
+		"  </body>\n"
+		"</worldbody></mujoco>\n";
+	HierarchyBuilder *hb = HierarchyBuilder::create();
+	RobotDescriptionStats stats;
+	CHECK(readText(hb, mjcf, stats));
+	CHECK(hb->getRigidBodyCount() == 5);
+	CHECK(hb->getJointCount() == 4);
+	CHECK(stats.mRigidBodyCount == 5);
+	CHECK(stats.mJointCount == 4);
+	CHECK(stats.mDuplicateCount == 1);
+	uint32_t torso = hb->getRigidBodyHandle("torso");
+	uint32_t shin = hb->getRigidBodyHandle("shin");
+	uint32_t b0 = INVALID_HANDLE;
+	uint32_t b1 = INVALID_HANDLE;
+	// The hip keeps its name although the body it moves has none
+	uint32_t hip = hb->getJointHandle("hip");
+	CHECK(hip != INVALID_HANDLE && hb->getJointBodies(hip, b0, b1));
+	CHECK(b0 == torso && b1 != INVALID_HANDLE && sameName(hb->getRigidBody(b1), ""));
+	uint32_t thigh = b1;
+	CHECK(hb->getJointBodies(hb->getJointHandle("knee"), b0, b1) && b0 == thigh && b1 == shin);
+	CHECK(hb->getJointHandle("knee_twist") == INVALID_HANDLE);
+	// The second shin is a rigid body of its own rather than another reference to the first
+	CHECK(hb->getJointBodies(hb->getJointHandle("other_knee"), b0, b1) && b0 == torso && b1 != shin && b1 != thigh);
+	CHECK(sameName(hb->getRigidBody(b1), ""));
+	// The foot is welded to the shin by an unnamed joint
+	uint32_t foot = hb->getRigidBodyHandle("foot");
+	uint32_t joints[4];
+	CHECK(hb->getBodyJoints(foot, joints, 4) == 1);
+	CHECK(hb->getJointBodies(joints[0], b0, b1) && b0 == shin && b1 == foot);
+	hb->release();
+}
+
+// A file several chunks long, padded with long comments, with a link and a joint just before each multiple of
+// the chunk size, so that the first link is split by the end of the first chunk
+void checkChunks(const std::string &directory)
+{
+	const size_t chunkSize = 256 * 1024;
+	std::string urdf = "<robot name=\"long\">\n<link name=\"body0\"/>\n";
+	uint32_t bodyCount = 1;
+	for (uint32_t i = 1; i < 12; i++)
+	{
+		// Pad with a comment so that the next link starts 'i * 7' characters before the boundary
+		size_t boundary = chunkSize * ((urdf.size() + 1024) / chunkSize + 1);
+		size_t target = boundary - i * 7;
+		urdf += "<!--";
+		urdf.append(target - urdf.size() - 4, ' ');
+		urdf += "-->";
+		char text[256];
+		snprintf(text, sizeof(text), "<link name=\"body%u\"/><joint name=\"joint%u\"><parent link=\"body%u\"/><child link=\"body%u\"/></joint>\n", i, i, i - 1, i);
+		urdf += text;
+		bodyCount++;
+	}
+	urdf += "</robot>\n";
+	std::string fileName = directory + "/reader_chunks.urdf";
+	FILE *fph = fopen(fileName.c_str(), "wb");
+	CHECK(fph != nullptr);
+	if (fph)
+	{
+		fwrite(urdf.data(), 1, urdf.size(), fph);
+		fclose(fph);
+		HierarchyBuilder *hb = HierarchyBuilder::create();
+		RobotDescriptionStats stats;
+		CHECK(readRobotDescriptionFile(hb, fileName.c_str(), &stats));
+		CHECK(hb->getRigidBodyCount() == bodyCount);
+		CHECK(hb->getJointCount() == bodyCount - 1);
+		CHECK(stats.mBytesRead == urdf.size());
+		for (uint32_t i = 1; i < bodyCount; i++)
+		{
+			char joint[32];
+			char body0[32];
+			char body1[32];
+			snprintf(joint, sizeof(joint), "joint%u", i);
+			snprintf(body0, sizeof(body0), "body%u", i - 1);
+			snprintf(body1, sizeof(body1), "body%u", i);
+			CHECK(hasJoint(hb, joint, body0, body1));
+		}
+		hb->release();
+		remove(fileName.c_str());
+	}
+}
+
+void checkErrors(void)
+{
+	HierarchyBuilder *hb = HierarchyBuilder::create();
+	RobotDescriptionStats stats;
+	const char *truncated = "<robot><link name=\"a\"/><link name=\"b";
+	CHECK(!readText(hb, truncated, stats));
+	CHECK(hb->getRigidBodyCount() == 1);
+	CHECK(!readRobotDescriptionFile(hb, "no/such/file.urdf", &stats));
+	hb->release();
+	// The reader's copies of the names do not outlive it, so it refuses a builder which borrows names
+	hb = HierarchyBuilder::create(nullptr, HBF_BORROW_NAMES);
+	CHECK(!readText(hb, "<robot><link name=\"a\"/></robot>", stats));
+	CHECK(hb->getRigidBodyCount() == 0);
+	hb->release();
+}
+
+int main(int argc, char **argv)
+{
+	std::string directory = argc > 1 ? argv[1] : ".";
+	checkUrdf();
+	checkSdf();
+	checkMjcf();
+	checkChunks(directory);
+	checkErrors();
+	return finishTest("reader");
+}
@@ -0,0 +1,174 @@
+// **********************************************************************************************************
+// Structure sharing.  A scene of many copies of the same robots built with mShareStructure reports exactly
+// what it reports without it: the same views, depth first views, loop flags, joint handles and names, both
+// after the build and after incremental updates.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+
+// One robot: a few limbs on a torso, one of them closed into a loop, with some joints pointing at the torso
+const uint32_t gRobotBodyCount = 12;
+const uint32_t gRobotJoints[][2] =
+{
+	{ 0, 1 }, { 1, 2 }, { 2, 3 }, { 4, 0 }, { 4, 5 }, { 5, 6 },
+	{ 0, 7 }, { 8, 7 }, { 8, 9 }, { 9, 10 }, { 10, 7 }, { 11, 0 }
+};
+
+// Copies of the robot, every fifth one with an extra joint so that it shares only with the other copies
+// which have it, interleaved with unconnected rigid bodies
+void addRobots(HierarchyBuilder *hb, uint32_t copies, bool named)
+{
+	char name[64];
+	char body0[64];
+	char body1[64];
+	uint32_t first = 0;
+	for (uint32_t c = 0; c < copies; c++)
+	{
+		for (uint32_t i = 0; i < gRobotBodyCount; i++)
+		{
+			if (named)
+			{
+				snprintf(name, sizeof(name), "robot_%u/link_%u", c, i);
+				hb->addRigidBody(name);
+			}
+			else
+			{
+				hb->addRigidBody();
+			}
+		}
+		uint32_t jointCount = uint32_t(sizeof(gRobotJoints) / sizeof(gRobotJoints[0]));
+		for (uint32_t j = 0; j <= jointCount; j++)
+		{
+			uint32_t b0 = j < jointCount ? gRobotJoints[j][0] : 3;
+			uint32_t b1 = j < jointCount ? gRobotJoints[j][1] : 6;
+			if (j == jointCount && c % 5 != 4)
+			{
+				break;
+			}
+			if (named)
+			{
+				snprintf(name, sizeof(name), "robot_%u/joint_%u", c, j);
+				snprintf(body0, sizeof(body0), "robot_%u/link_%u", c, b0);
+				snprintf(body1, sizeof(body1), "robot_%u/link_%u", c, b1);
+				hb->addJoint(name, body0, body1);
+			}
+			else
+			{
+				hb->addJoint(first + b0, first + b1);
+			}
+		}
+		first += gRobotBodyCount;
+		if (c % 3 == 0)
+		{
+			if (named)
+			{
+				snprintf(name, sizeof(name), "loose_%u", c);
+				hb->addRigidBody(name);
+			}
+			else
+			{
+				hb->addRigidBody();
+			}
+			first++;
+		}
+	}
+}
+
+// Walks both hierarchies through the HierarchyLink interface, comparing every joint of every link
+bool sameLinks(const HierarchyLink *a, const HierarchyLink *b)
+{
+	bool ret = true;
+
+	std::vector< std::pair< const HierarchyLink *, const HierarchyLink * > > stack;
+	stack.push_back(std::make_pair(a, b));
+	while (ret && !stack.empty())
+	{
+		a = stack.back().first;
+		b = stack.back().second;
+		stack.pop_back();
+		ret = a && b && a->getRigidBodyIndex() == b->getRigidBodyIndex() && sameName(a->getRigidBody(), b->getRigidBody()) &&
+			a->getChildCount() == b->getChildCount();
+		for (uint32_t i = 0; ret && i < a->getChildCount(); i++)
+		{
+			uint32_t a0;
+			uint32_t a1;
+			uint32_t b0;
+			uint32_t b1;
+			bool loopA;
+			bool loopB;
+			ret = a->getJointIndex(i, a0, a1, loopA) == b->getJointIndex(i, b0, b1, loopB) && a0 == b0 && a1 == b1 && loopA == loopB;
+			const char *n0;
+			const char *n1;
+			std::string jointA = a->getJoint(i, n0, n1, loopA);
+			std::string namesA = jointA + " " + n0 + " " + n1;
+			std::string jointB = b->getJoint(i, n0, n1, loopB);
+			ret = ret && namesA == jointB + " " + n0 + " " + n1 && loopA == loopB;
+			stack.push_back(std::make_pair(a->getChild(i), b->getChild(i)));
+		}
+	}
+
+	return ret;
+}
+
+void compare(HierarchyBuilder *shared, HierarchyBuilder *plain)
+{
+	CHECK(sameHierarchies(shared, plain));
+	CHECK(sameDepthFirstViews(shared, plain));
+	for (uint32_t i = 0; i < plain->getHierarchyCount(); i++)
+	{
+		CHECK(sameLinks(shared->getHierarchyRoot(i), plain->getHierarchyRoot(i)));
+	}
+}
+
+void checkShare(uint32_t copies, bool named, RootPolicy policy)
+{
+	BuildOptions options;
+	options.mDepthFirstView = true;
+	options.mPathQueries = true;
+	options.mRootPolicy = policy;
+	BuildOptions share = options;
+	share.mShareStructure = true;
+	HierarchyBuilder *shared = HierarchyBuilder::create();
+	HierarchyBuilder *plain = HierarchyBuilder::create();
+	addRobots(shared, copies, named);
+	addRobots(plain, copies, named);
+	shared->build(share);
+	plain->build(options);
+	compare(shared, plain);
+	BuildStats stats;
+	if (shared->getBuildStats(stats))
+	{
+		// Every robot but the first of each kind shares
+		CHECK(stats.mSharedHierarchyCount == copies - 2);
+	}
+	// Updates rebuild the affected hierarchies without sharing; the others still share
+	Random random(copies);
+	for (uint32_t i = 0; i < 10; i++)
+	{
+		uint32_t joint = random.next(plain->getJointCount());
+		shared->removeJoint(joint);
+		plain->removeJoint(joint);
+		uint32_t body0 = random.next(plain->getRigidBodyCount());
+		uint32_t body1 = random.next(plain->getRigidBodyCount());
+		shared->addJoint(body0, body1);
+		plain->addJoint(body0, body1);
+	}
+	compare(shared, plain);
+	shared->release();
+	plain->release();
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+	for (uint32_t policy = 0; policy <= ROOT_MAX_DEGREE; policy++)
+	{
+		if (policy != ROOT_SPECIFIED)
+		{
+			checkShare(50, false, RootPolicy(policy));
+			checkShare(50, true, RootPolicy(policy));
+		}
+	}
+	return finishTest("share");
+}
@@ -0,0 +1,170 @@
+// **********************************************************************************************************
+// Snapshots.  A saved snapshot maps back to the same hierarchies, names and handles; a truncated one is
+// rejected by load and a corrupt one by load with HSF_VALIDATE; and the HierarchyLink adapters are created
+// safely when several threads ask for them at once.
+// **********************************************************************************************************
+
+#include "TestHarness.h"
+#include <thread>
+
+bool copyFile(const std::string &source, const std::string &dest, size_t size)
+{
+	bool ret = false;
+	FILE *in = fopen(source.c_str(), "rb");
+	FILE *out = fopen(dest.c_str(), "wb");
+	if (in && out)
+	{
+		std::vector< char > data(size);
+		ret = size == 0 || (fread(data.data(), 1, size, in) == size && fwrite(data.data(), 1, size, out) == size);
+	}
+	if (in)
+	{
+		fclose(in);
+	}
+	if (out)
+	{
+		fclose(out);
+	}
+	return ret;
+}
+
+// Overwriting the middle of the file leaves the header and every section in bounds but the indices out of
+// range.  Only HSF_VALIDATE reads far enough to notice; without it load only checks the header.
+void checkCorruption(const std::string &fileName, const std::string &damaged, size_t size)
+{
+	if (CHECK(copyFile(fileName, damaged, size)))
+	{
+		FILE *fph = fopen(damaged.c_str(), "r+b");
+		if (CHECK(fph != nullptr))
+		{
+			std::vector< char > garbage(size / 2, char(0xFF));
+			fseek(fph, long(size / 4), SEEK_SET);
+			fwrite(garbage.data(), 1, garbage.size(), fph);
+			fclose(fph);
+		}
+		HierarchySnapshot *bad = HierarchySnapshot::load(damaged.c_str(), nullptr, HSF_VALIDATE);
+		CHECK(bad == nullptr);
+		if (bad)
+		{
+			bad->release();
+		}
+		HierarchySnapshot *unchecked = HierarchySnapshot::load(damaged.c_str());
+		CHECK(unchecked != nullptr);
+		if (unchecked)
+		{
+			unchecked->release();
+		}
+	}
+}
+
+// Threads asking for the roots of the same hierarchies at once all get the same adapters
+void checkThreads(const std::string &fileName, HierarchyBuilder *hb)
+{
+	HierarchySnapshot *snapshot = HierarchySnapshot::load(fileName.c_str(), nullptr, HSF_VALIDATE);
+	if (CHECK(snapshot != nullptr))
+	{
+		const uint32_t threadCount = 8;
+		uint32_t count = snapshot->getHierarchyCount();
+		std::vector< const HierarchyLink * > roots(size_t(threadCount) * count);
+		std::vector< std::thread > threads;
+		for (uint32_t t = 0; t < threadCount; t++)
+		{
+			threads.push_back(std::thread([snapshot, count, t, &roots]()
+			{
+				for (uint32_t i = 0; i < count; i++)
+				{
+					// Each thread starts at a different hierarchy so that they collide on every one
+					uint32_t index = (i + t * 7) % count;
+					roots[size_t(t) * count + index] = snapshot->getHierarchyRoot(index);
+				}
+			}));
+		}
+		for (auto &i : threads)
+		{
+			i.join();
+		}
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const HierarchyLink *root = roots[i];
+			CHECK(root && root->getRigidBodyIndex() == hb->getHierarchyRoot(i)->getRigidBodyIndex());
+			for (uint32_t t = 1; t < threadCount; t++)
+			{
+				CHECK(roots[size_t(t) * count + i] == root);
+			}
+		}
+		snapshot->release();
+	}
+}
+
+void checkSnapshot(const std::string &directory)
+{
+	std::string fileName = directory + "/tests_snapshot.hbs";
+	HierarchyBuilder *hb = HierarchyBuilder::create();
+	addScene(hb, 1, 400, true);
+	hb->build();
+	// Removed rigid bodies and joints keep their handles in the snapshot
+	hb->removeRigidBody(7);
+	hb->removeJoint(3);
+	CHECK(hb->save(fileName.c_str()));
+	HierarchySnapshot *snapshot = HierarchySnapshot::load(fileName.c_str());
+	if (CHECK(snapshot != nullptr))
+	{
+		CHECK(sameHierarchies(hb, snapshot));
+		CHECK(snapshot->getRigidBodyCount() == hb->getRigidBodyCount());
+		for (uint32_t i = 0; i < hb->getRigidBodyCount(); i++)
+		{
+			CHECK(sameName(snapshot->getRigidBody(i), hb->getRigidBody(i)));
+		}
+		CHECK(snapshot->getJointCount() == hb->getJointCount());
+		for (uint32_t i = 0; i < hb->getJointCount(); i++)
+		{
+			const char *a0;
+			const char *a1;
+			const char *b0;
+			const char *b1;
+			CHECK(sameName(snapshot->getJoint(i, a0, a1), hb->getJoint(i, b0, b1)));
+			CHECK(sameName(a0, b0) && sameName(a1, b1));
+		}
+		for (uint32_t i = 0; i < hb->getDisconnectedRigidBodyCount(); i++)
+		{
+			CHECK(sameName(snapshot->getDisconnectedRigidBody(i), hb->getDisconnectedRigidBody(i)));
+		}
+		const HierarchyLink *root = snapshot->getHierarchyRoot(0);
+		CHECK(root && sameName(root->getRigidBody(), hb->getHierarchyRoot(0)->getRigidBody()));
+		snapshot->release();
+	}
+	// Every truncation of the file is rejected
+	FILE *fph = fopen(fileName.c_str(), "rb");
+	size_t size = 0;
+	if (CHECK(fph != nullptr))
+	{
+		fseek(fph, 0, SEEK_END);
+		size = size_t(ftell(fph));
+		fclose(fph);
+	}
+	std::string damaged = directory + "/tests_snapshot_damaged.hbs";
+	for (size_t keep = 0; keep < size; keep += size / 7 + 1)
+	{
+		if (CHECK(copyFile(fileName, damaged, keep)))
+		{
+			HierarchySnapshot *bad = HierarchySnapshot::load(damaged.c_str());
+			CHECK(bad == nullptr);
+			if (bad)
+			{
+				bad->release();
+			}
+		}
+	}
+	checkCorruption(fileName, damaged, size);
+	checkThreads(fileName, hb);
+	remove(fileName.c_str());
+	remove(damaged.c_str());
+	hb->release();
+}
+
+int main(int argc, char **argv)
+{
+	std::string directory = argc > 1 ? argv[1] : ".";
+	checkSnapshot(directory);
+	return finishTest("snapshot");
+}
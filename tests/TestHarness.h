@@ -0,0 +1,158 @@
+#pragma once
+
+// **********************************************************************************************************
+// Shared helpers for the behaviour checks in this directory.  Each check is its own executable, registered
+// with CTest, which compares the builder against a second, independent answer on small generated scenes
+// and returns non-zero if any CHECK failed.  CTest passes the build directory as the first argument for
+// checks which write files.
+// **********************************************************************************************************
+
+#include "../HierarchyBuilder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace HIERARCHY_BUILDER;
+
+typedef std::vector< uint32_t > IndexVector;
+
+static uint32_t gFailures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+inline bool check(bool condition, const char *text, const char *file, int line)
+{
+	if (!condition)
+	{
+		printf("%s(%d): check failed: %s\n", file, line, text);
+		gFailures++;
+	}
+	return condition;
+}
+
+inline bool sameName(const char *a, const char *b)
+{
+	return (a && b) ? strcmp(a, b) == 0 : a == b;
+}
+
+// Small deterministic generator so every run checks the same scenes
+class Random
+{
+public:
+	Random(uint32_t seed) : mState(seed * 2654435761u + 1)
+	{
+	}
+
+	uint32_t next(uint32_t range)
+	{
+		mState ^= mState << 13;
+		mState ^= mState >> 17;
+		mState ^= mState << 5;
+		return mState % range;
+	}
+
+	uint32_t mState;
+};
+
+// A forest of random trees with a few loop closing joints and some rigid bodies left unconnected.  Joints
+// are added in shuffled order and with random direction, so the builder has to find every root itself.
+inline void addScene(HierarchyBuilder *hb, uint32_t seed, uint32_t bodyCount, bool named)
+{
+	Random random(seed);
+	std::vector< std::pair< uint32_t, uint32_t > > joints;
+	for (uint32_t i = 1; i < bodyCount; i++)
+	{
+		if (random.next(8) != 0)
+		{
+			uint32_t parent = i - 1 - random.next(i < 6 ? i : 6);
+			joints.push_back(random.next(4) ? std::make_pair(parent, i) : std::make_pair(i, parent));
+		}
+	}
+	for (uint32_t i = 0; i < bodyCount / 16; i++)
+	{
+		joints.push_back(std::make_pair(random.next(bodyCount), random.next(bodyCount)));
+	}
+	for (size_t i = joints.size(); i > 1; i--)
+	{
+		std::swap(joints[i - 1], joints[random.next(uint32_t(i))]);
+	}
+	char name[64];
+	char body0[64];
+	char body1[64];
+	for (uint32_t i = 0; i < bodyCount; i++)
+	{
+		if (named)
+		{
+			snprintf(name, sizeof(name), "robot_%05u/link_%u", i / 20, i);
+			hb->addRigidBody(name);
+		}
+		else
+		{
+			hb->addRigidBody();
+		}
+	}
+	for (size_t i = 0; i < joints.size(); i++)
+	{
+		if (named)
+		{
+			snprintf(name, sizeof(name), "robot_%05u/joint_%u", uint32_t(i / 20), uint32_t(i));
+			snprintf(body0, sizeof(body0), "robot_%05u/link_%u", joints[i].first / 20, joints[i].first);
+			snprintf(body1, sizeof(body1), "robot_%05u/link_%u", joints[i].second / 20, joints[i].second);
+			hb->addJoint(name, body0, body1);
+		}
+		else
+		{
+			hb->addJoint(joints[i].first, joints[i].second);
+		}
+	}
+}
+
+template< typename A, typename B > inline bool sameHierarchies(A *a, B *b)
+{
+	bool ret = a->getHierarchyCount() == b->getHierarchyCount();
+	for (uint32_t i = 0; ret && i < a->getHierarchyCount(); i++)
+	{
+		HierarchyView va;
+		HierarchyView vb;
+		ret = a->getHierarchyView(i, va) && b->getHierarchyView(i, vb) && va.mNodeCount == vb.mNodeCount &&
+			memcmp(va.mRigidBodies, vb.mRigidBodies, sizeof(uint32_t) * va.mNodeCount) == 0 &&
+			memcmp(va.mJoints, vb.mJoints, sizeof(uint32_t) * va.mNodeCount) == 0 &&
+			memcmp(va.mLoopJoints, vb.mLoopJoints, va.mNodeCount) == 0 &&
+			memcmp(va.mChildOffsets, vb.mChildOffsets, sizeof(uint32_t) * (va.mNodeCount + 1)) == 0;
+	}
+	ret = ret && a->getDisconnectedRigidBodyCount() == b->getDisconnectedRigidBodyCount();
+	for (uint32_t i = 0; ret && i < a->getDisconnectedRigidBodyCount(); i++)
+	{
+		ret = a->getDisconnectedRigidBodyIndex(i) == b->getDisconnectedRigidBodyIndex(i);
+	}
+	return ret;
+}
+
+inline bool sameDepthFirstViews(HierarchyBuilder *a, HierarchyBuilder *b)
+{
+	bool ret = a->getHierarchyCount() == b->getHierarchyCount();
+	for (uint32_t i = 0; ret && i < a->getHierarchyCount(); i++)
+	{
+		DepthFirstView va;
+		DepthFirstView vb;
+		ret = a->getDepthFirstView(i, va) && b->getDepthFirstView(i, vb) &&
+			va.mBodyCount == vb.mBodyCount && va.mLoopJointCount == vb.mLoopJointCount &&
+			memcmp(va.mRigidBodies, vb.mRigidBodies, sizeof(uint32_t) * va.mBodyCount) == 0 &&
+			memcmp(va.mParents, vb.mParents, sizeof(uint32_t) * va.mBodyCount) == 0 &&
+			memcmp(va.mJoints, vb.mJoints, sizeof(uint32_t) * va.mBodyCount) == 0 &&
+			memcmp(va.mSubtreeEnds, vb.mSubtreeEnds, sizeof(uint32_t) * va.mBodyCount) == 0 &&
+			memcmp(va.mLoopJoints, vb.mLoopJoints, sizeof(uint32_t) * va.mLoopJointCount) == 0;
+	}
+	return ret;
+}
+
+// Report the outcome of a test executable and return its exit code
+inline int finishTest(const char *name)
+{
+	printf("%s: %u failed checks\n", name, gFailures);
+	return gFailures ? 1 : 0;
+}